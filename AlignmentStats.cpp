@@ -0,0 +1,106 @@
+/*
+  Timings and counters for the stages of an alignment.
+*/
+
+#include "AlignmentStats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+
+AlignmentStats::AlignmentStats()
+{
+    reset();
+}
+
+void AlignmentStats::reset()
+{
+    for (auto& ns : m_nanoseconds) ns.store(0);
+    for (auto& c : m_counters) c.store(0);
+    std::lock_guard<std::mutex> guard(m_beamMutex);
+    m_beamFrames = 0;
+    m_beamHypotheses = 0;
+    m_beamMaxHypotheses = 0;
+    m_beamPruned = 0.;
+    m_beamMaxPruned = 0.;
+}
+
+void AlignmentStats::addTime(Stage stage, double seconds)
+{
+    m_nanoseconds[stage].fetch_add(int64_t(seconds * 1e9), std::memory_order_relaxed);
+}
+
+void AlignmentStats::addBeam(int64_t frames, int64_t hypotheses, int64_t maxHypotheses,
+                             double pruned, double maxPruned)
+{
+    std::lock_guard<std::mutex> guard(m_beamMutex);
+    m_beamFrames += frames;
+    m_beamHypotheses += hypotheses;
+    m_beamMaxHypotheses = std::max(m_beamMaxHypotheses, maxHypotheses);
+    m_beamPruned += pruned;
+    m_beamMaxPruned = std::max(m_beamMaxPruned, maxPruned);
+}
+
+void AlignmentStats::add(const AlignmentStats& other)
+{
+    for (int stage = 0; stage < StageCount; stage++) {
+        m_nanoseconds[stage].fetch_add(other.m_nanoseconds[stage].load());
+    }
+    for (int counter = 0; counter < CounterCount; counter++) {
+        m_counters[counter].fetch_add(other.m_counters[counter].load());
+    }
+    std::lock_guard<std::mutex> otherGuard(other.m_beamMutex);
+    addBeam(other.m_beamFrames, other.m_beamHypotheses, other.m_beamMaxHypotheses,
+            other.m_beamPruned, other.m_beamMaxPruned);
+}
+
+AlignmentStats::Values AlignmentStats::getValues() const
+{
+    auto seconds = [&](Stage stage) { return m_nanoseconds[stage].load() * 1e-9; };
+    auto count = [&](Counter counter) { return double(m_counters[counter].load()); };
+
+    Values values;
+    values.push_back({ "featureIngestion.seconds", seconds(FeatureIngestion) });
+    values.push_back({ "featureIngestion.frames", count(FeatureFrames) });
+    values.push_back({ "graphConstruction.seconds", seconds(GraphConstruction) });
+    values.push_back({ "graphConstruction.graphs", count(GraphsBuilt) });
+    values.push_back({ "likelihood.calls", count(LikelihoodCalls) });
+    values.push_back({ "likelihood.evaluations", count(LikelihoodEvaluations) });
+    values.push_back({ "likelihood.cacheHits",
+                       count(LikelihoodCalls) - count(LikelihoodEvaluations) });
+    values.push_back({ "likelihood.loaded", count(LikelihoodsLoaded) });
+    values.push_back({ "forward.seconds", seconds(ForwardPass) });
+    values.push_back({ "backward.seconds", seconds(BackwardPass) });
+
+    std::lock_guard<std::mutex> guard(m_beamMutex);
+    double frames = std::max<int64_t>(m_beamFrames, 1);
+    values.push_back({ "beam.frames", double(m_beamFrames) });
+    values.push_back({ "beam.meanOccupancy", m_beamHypotheses / frames });
+    values.push_back({ "beam.maxOccupancy", double(m_beamMaxHypotheses) });
+    values.push_back({ "beam.meanPrunedMass", m_beamPruned / frames });
+    values.push_back({ "beam.maxPrunedMass", m_beamMaxPruned });
+    values.push_back({ "beam.latticeBytes", count(LatticeBytes) });
+
+    values.push_back({ "onsetExtraction.seconds", seconds(OnsetExtraction) });
+    return values;
+}
+
+bool AlignmentStats::writeJson(const Values& values, string path)
+{
+    std::ofstream out(path, std::ios::trunc);
+    if (!out) return false;
+    out.precision(9);
+    out << "{\n";
+    for (size_t i = 0; i < values.size(); i++) {
+        out << "  \"" << values[i].first << "\": ";
+        if (std::isfinite(values[i].second)) {
+            out << values[i].second;
+        } else {
+            out << "null";
+        }
+        out << (i + 1 < values.size() ? ",\n" : "\n");
+    }
+    out << "}\n";
+    return bool(out);
+}
@@ -0,0 +1,103 @@
+/*
+  Timings and counters for the stages of an alignment, cheap enough to
+  be gathered all the time, so that where the time goes can be seen
+  from outside (see PianoAligner's alignmentstats output) without a
+  profiler.
+*/
+
+#ifndef ALIGNMENT_STATS_H
+#define ALIGNMENT_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+
+class AlignmentStats
+{
+public:
+    enum Stage {
+        FeatureIngestion,
+        GraphConstruction,
+        ForwardPass,
+        BackwardPass,
+        OnsetExtraction,
+        StageCount
+    };
+
+    enum Counter {
+        FeatureFrames,
+        GraphsBuilt,
+        LikelihoodCalls, // including those answered from the cache
+        LikelihoodEvaluations,
+        LikelihoodsLoaded, // from a LikelihoodCache
+        LatticeBytes, // memory taken by the lattices of each pass, summed
+        CounterCount
+    };
+
+    AlignmentStats();
+
+    // All of these may be called from several threads at once
+    void addTime(Stage stage, double seconds);
+    void count(Counter counter, int64_t n = 1) {
+        m_counters[counter].fetch_add(n, std::memory_order_relaxed);
+    }
+
+    // The beam after pruning in one pass over some frames: the total
+    // and greatest number of hypotheses kept per frame, and the total
+    // and greatest proportion of probability mass pruned per frame
+    void addBeam(int64_t frames, int64_t hypotheses, int64_t maxHypotheses,
+                 double pruned, double maxPruned);
+
+    // Add everything from another set, e.g. that of a coarse pass
+    void add(const AlignmentStats& other);
+
+    void reset();
+
+    // Every statistic, by name, in a fixed order
+    typedef vector<std::pair<string, double>> Values;
+    Values getValues() const;
+
+    // Write values as a flat JSON object. Returns false on failure.
+    static bool writeJson(const Values& values, string path);
+
+    // Adds the time from construction to destruction to a stage
+    class Timer
+    {
+    public:
+        Timer(AlignmentStats& stats, Stage stage) :
+            m_stats(stats), m_stage(stage),
+            m_start(std::chrono::steady_clock::now()) { }
+        ~Timer() {
+            m_stats.addTime(m_stage, std::chrono::duration<double>
+                            (std::chrono::steady_clock::now() - m_start).count());
+        }
+    private:
+        AlignmentStats& m_stats;
+        Stage m_stage;
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+private:
+    AlignmentStats(const AlignmentStats&) = delete;
+    AlignmentStats& operator=(const AlignmentStats&) = delete;
+
+    std::atomic<int64_t> m_nanoseconds[StageCount];
+    std::atomic<int64_t> m_counters[CounterCount];
+
+    mutable std::mutex m_beamMutex;
+    int64_t m_beamFrames;
+    int64_t m_beamHypotheses;
+    int64_t m_beamMaxHypotheses;
+    double m_beamPruned;
+    double m_beamMaxPruned;
+};
+
+#endif
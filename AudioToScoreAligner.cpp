@@ -4,18 +4,48 @@
 
 
 #include "AudioToScoreAligner.h"
-#include "Templates.h"
-#include "Paths.h"
+#include "CacheKey.h"
+#include "LikelihoodCache.h"
+#include "Log.h"
+#include "Parallel.h"
+#include "ScoreCache.h"
+#include "ScoreModel.h"
 #include "SimpleHMM.h"
 
+#include <algorithm>
 #include <cmath>
-#include <filesystem>
+#include <limits>
 #include <vector>
 
+static const int FIRST_PASS_BEAM_WIDTH = 20;
+static const double CONFIDENT_POSTERIOR = 0.99;
+static const int MIN_SEGMENT_FRAMES = 500;
+static const double COARSE_POSTERIOR_THRESHOLD = 1e-4;
+static const int COARSE_EVENT_MARGIN = 2;
+
+// Bump this whenever calculateLikelihood() or the silence template
+// changes, so that likelihoods kept on disk by older code are not
+// reused (a change to the templates is tracked by ScoreCache's version)
+static const int LIKELIHOOD_MODEL_VERSION = 1;
+
 
 AudioToScoreAligner::AudioToScoreAligner(float inputSampleRate, int hopSize) :
-    m_inputSampleRate{inputSampleRate} , m_hopSize{hopSize}
+    m_inputSampleRate{inputSampleRate} , m_hopSize{hopSize},
+    m_startEvent{0}, m_endEvent{0}, m_coarseFactor{1},
+    m_bandWidth{-1.}, m_bandRatio{0.}, m_bandRescale{true},
+    m_denseLikelihoods{false}, m_priority{ThreadPool::Normal},
+    m_persistLikelihoods{false}
+{
+}
+
+AudioToScoreAligner::AudioToScoreAligner(std::shared_ptr<const ScoreModel> model) :
+    m_inputSampleRate{model->getSampleRate()}, m_hopSize{model->getHopSize()},
+    m_model{model}, m_startEvent{0}, m_endEvent{0}, m_coarseFactor{1},
+    m_bandWidth{-1.}, m_bandRatio{0.}, m_bandRescale{true},
+    m_denseLikelihoods{false}, m_priority{ThreadPool::Normal},
+    m_persistLikelihoods{false}
 {
+    setEventRange(0, m_model->getScore().getMusicalEvents().size());
 }
 
 AudioToScoreAligner::~AudioToScoreAligner()
@@ -24,54 +54,96 @@ AudioToScoreAligner::~AudioToScoreAligner()
 
 bool AudioToScoreAligner::loadAScore(string scoreName, int blockSize)
 {
-    std::cerr << "In loadAScore: scoreName is -> " << scoreName << '\n';
-
-    auto scores = Paths::getScores();
+    auto model = std::make_shared<ScoreModel>(m_inputSampleRate, m_hopSize, blockSize);
+    bool success = model->load(scoreName);
+    m_model = model;
 
-    if (scores.find(scoreName) == scores.end()) {
-        std::cerr << "Score not found: " << scoreName << '\n';
-        return false;
-    }
+    setEventRange(0, m_model->getScore().getMusicalEvents().size());
 
-    std::filesystem::path targetPath = scores[scoreName];
+    return success;
+}
 
-    // Paths::getScores() has already verified that these exist
-    std::string scorePath = targetPath.string() + "/" + scoreName + ".solo";
-    std::string scoreTempoPath = targetPath.string() + "/" + scoreName + ".tempo";
-    std::string scoreMeterPath = targetPath.string() + "/" + scoreName + ".meter";
+std::shared_ptr<const ScoreModel> AudioToScoreAligner::getModel() const
+{
+    return m_model;
+}
 
-    bool success = m_score.initialize(scorePath);
-    if (success)    success = m_score.readTempo(scoreTempoPath);
-    if (success)    success = m_score.readMeter(scoreMeterPath);
+void AudioToScoreAligner::setEventRange(int startEvent, int endEvent)
+{
+    int events = getScore().getMusicalEvents().size();
+    if (startEvent < 0) startEvent = 0;
+    if (endEvent > events) endEvent = events;
+    if (endEvent < startEvent) endEvent = startEvent;
+    m_startEvent = startEvent;
+    m_endEvent = endEvent;
+
+    // Likelihoods are stored per event in the range
+    m_likelihoods.clear();
+    m_silenceLikelihoods.clear();
+    m_corridor.clear();
+    m_results.clear();
+}
 
-    NoteTemplates t =
-        CreateNoteTemplates::getNoteTemplates(m_inputSampleRate, blockSize);
-    m_score.setEventTemplates(t);
+int AudioToScoreAligner::getStartEvent() const
+{
+    return m_startEvent;
+}
 
-    return success;
+int AudioToScoreAligner::getEndEvent() const
+{
+    return m_endEvent;
 }
 
 void AudioToScoreAligner::supplyFeature(DataSpectrum s)
 {
     m_dataFeatures.push_back(s);
+    m_stats.count(AlignmentStats::FeatureFrames);
 }
 
 void AudioToScoreAligner::initializeLikelihoods()
 {
     int frames = m_dataFeatures.size();
-    int events = m_score.getMusicalEvents().size();
+    int events = m_endEvent - m_startEvent; // only those being aligned
+
+    // Each frame's score against the baseline log-template, which every
+    // event's likelihood starts from
+    if (int(m_baselineScores.size()) != frames) {
+        const double* baseline = m_model->getBaselineLogTemplate();
+        m_baselineScores.clear();
+        for (int frame = 0; frame < frames; frame++) {
+            double score = 0;
+            for (int bin = 0; bin < int(m_dataFeatures[frame].size()); bin++) {
+                score += m_dataFeatures[frame][bin]*baseline[bin];
+            }
+            m_baselineScores.push_back(score);
+        }
+    }
+
+    if (int(m_likelihoods.size()) == frames) {
+        return; // keep those already calculated
+    }
+    m_likelihoods.clear();
+    m_silenceLikelihoods.clear();
+    openLikelihoodCache();
     if (frames == 0) {
-        std::cerr << "AudioToScoreAligner::initializeLikelihoods:\
-        features are not supplied." << '\n';
+        LOG_WARNING("AudioToScoreAligner::initializeLikelihoods: features are not supplied.");
     }
-    std::cerr << "AudioToScoreAligner::initializeLikelihoods:\
-    features are indeed supplied. Number of frames = " << frames << '\n';
+    LOG_DEBUG("AudioToScoreAligner::initializeLikelihoods: Number of frames = " << frames);
+    // With a corridor, only the events within it are stored for each
+    // frame; m_likelihoodStart holds the first of them. Any the beam
+    // asks for outside it go in m_outsideLikelihoods instead.
+    m_likelihoodStart.clear();
+    m_outsideLikelihoods.assign(frames, {});
     for (int frame = 0; frame < frames; frame++) {
-        vector<Likelihood> l;
-        for (int event = 0; event < events; event++) {
-            l.push_back(Likelihood(0, false));
+        int first = m_startEvent;
+        int count = events;
+        if (!m_corridor.empty()) {
+            first = std::max(m_corridor[frame].first, m_startEvent);
+            count = std::min(m_corridor[frame].second + 1, m_endEvent) - first;
+            if (count < 0) count = 0;
         }
-        m_likelihoods.push_back(l);
+        m_likelihoods.push_back(vector<Likelihood>(count, Likelihood(0, false)));
+        m_likelihoodStart.push_back(first);
     }
 
     // event = -1 and -2:
@@ -81,40 +153,104 @@ void AudioToScoreAligner::initializeLikelihoods()
         l.push_back(Likelihood(0, false)); // event = -2
         m_silenceLikelihoods.push_back(l);
     }
+
 }
 
+void AudioToScoreAligner::openLikelihoodCache()
+{
+    int frames = m_dataFeatures.size();
+    if (!m_persistLikelihoods || frames == 0) {
+        m_likelihoodCache.reset();
+        return;
+    }
+    if (m_likelihoodCache && m_likelihoodCache->getFrameCount() == frames) {
+        return; // features are only ever added, so these are still theirs
+    }
 
-double AudioToScoreAligner::getLikelihood(int frame, int event)
+    // The likelihoods depend on nothing else, so that a change to the
+    // range or decoding settings still finds them
+    CacheKey key;
+    key.add("likelihoods");
+    key.add(double(LIKELIHOOD_MODEL_VERSION));
+    key.add(double(ScoreCache::getVersion()));
+    key.add(m_inputSampleRate);
+    key.add(m_model->getBinCount());
+    key.add(m_denseLikelihoods ? 1 : 0);
+    key.addScore(getScore());
+    key.addFeatures(m_dataFeatures);
+
+    auto cache = std::make_unique<LikelihoodCache>();
+    if (!cache->isEnabled()) {
+        m_likelihoodCache.reset();
+        return;
+    }
+    cache->open(key, frames);
+    m_likelihoodCache = std::move(cache);
+}
+
+void AudioToScoreAligner::storeLikelihoods()
 {
-    if (m_dataFeatures.size() == 0) {
-        std::cerr << "AudioToScoreAligner::getLikelihood:\
-        features are not supplied." << '\n';
-    }
-    static Template silenceTemplate;
-    static bool haveInitializedSilenceTemplates = false;
-    if (!haveInitializedSilenceTemplates) { // TODO: Change it later.
-        int bins = m_dataFeatures[frame].size();
-        double low_freq = 20.;
-        double low_proportion = .5;
-        double p1 = low_proportion / low_freq;
-        double p2 = (1 - low_proportion) / (double)bins;
-        for (int bin = 0; bin < bins; bin++) {
-            if (bin < low_freq) {
-                silenceTemplate.push_back(p1 + p2);
-            } else {
-                silenceTemplate.push_back(p2);
+    if (!m_likelihoodCache || m_likelihoods.size() != m_dataFeatures.size()) return;
+
+    // Only worth writing if something was calculated that is not stored
+    bool added = false;
+    double stored;
+    vector<LikelihoodCache::Band> bands(m_likelihoods.size());
+    for (int frame = 0; frame < int(m_likelihoods.size()); frame++) {
+        const vector<Likelihood>& row = m_likelihoods[frame];
+        int first = 0, end = int(row.size());
+        while (first < end && !row[first].calculated) first++;
+        while (end > first && !row[end - 1].calculated) end--;
+        LikelihoodCache::Band& band = bands[frame];
+        band.first = m_likelihoodStart[frame] + first;
+        for (int i = first; i < end; i++) {
+            if (!row[i].calculated) {
+                band.values.push_back(std::numeric_limits<double>::quiet_NaN());
+                continue;
+            }
+            band.values.push_back(row[i].likelihood);
+            if (!added && !m_likelihoodCache->find(frame, m_likelihoodStart[frame] + i, stored)) {
+                added = true;
             }
         }
-        haveInitializedSilenceTemplates = true;
+        band.silence = std::numeric_limits<double>::quiet_NaN();
+        for (const auto& silence : m_silenceLikelihoods[frame]) {
+            if (silence.calculated) band.silence = silence.likelihood;
+        }
+        if (!added && !std::isnan(band.silence) &&
+            !m_likelihoodCache->findSilence(frame, stored)) {
+            added = true;
+        }
     }
+    if (added) m_likelihoodCache->store(bands);
+}
+
+
+double AudioToScoreAligner::getLikelihood(int frame, int event)
+{
+    if (m_dataFeatures.size() == 0) {
+        LOG_WARNING("AudioToScoreAligner::getLikelihood: features are not supplied.");
+    }
+    if (m_likelihoods.size() != m_dataFeatures.size()) {
+        initializeLikelihoods(); // called before any alignment
+    }
+    const double* silenceLogTemplate = m_model->getSilenceLogTemplate();
+    m_stats.count(AlignmentStats::LikelihoodCalls);
 
     // TODO: check the range for frame and event
     // If event < 0, use a different template:
     if (event < 0) {
+        Likelihood& silence = m_silenceLikelihoods[frame][std::abs(event)-1];
+        if (!silence.calculated && m_likelihoodCache &&
+            m_likelihoodCache->findSilence(frame, silence.likelihood)) {
+            m_stats.count(AlignmentStats::LikelihoodsLoaded);
+            silence.calculated = true;
+        }
         if(!m_silenceLikelihoods[frame][std::abs(event)-1].calculated) {
+            m_stats.count(AlignmentStats::LikelihoodEvaluations);
             double score = 0;
             for (int bin = 0; bin < m_dataFeatures[frame].size(); bin++) {
-                score += m_dataFeatures[frame][bin]*log(silenceTemplate[bin]);
+                score += m_dataFeatures[frame][bin]*silenceLogTemplate[bin];
                 /*
                 if (frame == 2 && event == -1) {
                     if (isnan(score)) {
@@ -137,49 +273,425 @@ double AudioToScoreAligner::getLikelihood(int frame, int event)
         return m_silenceLikelihoods[frame][std::abs(event)-1].likelihood;
     }
 
-    if (!m_likelihoods[frame][event].calculated) {
-        const Score::MusicalEventList& eventList = m_score.getMusicalEvents();
+    int index = event - m_likelihoodStart[frame];
+    if (index < 0 || index >= int(m_likelihoods[frame].size())) {
+        // Outside the corridor, as once the beam leaves it (e.g. for an
+        // anchor it missed), when each later frame will come here too
+        auto inserted = m_outsideLikelihoods[frame].insert({ event, 0. });
+        double& outside = inserted.first->second;
+        if (inserted.second) {
+            if (m_likelihoodCache && m_likelihoodCache->find(frame, event, outside)) {
+                m_stats.count(AlignmentStats::LikelihoodsLoaded);
+            } else {
+                outside = calculateLikelihood(frame, event);
+            }
+        }
+        return outside;
+    }
+    Likelihood& cached = m_likelihoods[frame][index];
+    if (!cached.calculated) {
+        if (m_likelihoodCache && m_likelihoodCache->find(frame, event, cached.likelihood)) {
+            m_stats.count(AlignmentStats::LikelihoodsLoaded);
+        } else {
+            cached.likelihood = calculateLikelihood(frame, event);
+        }
+        cached.calculated = true;
+    }
+
+    return cached.likelihood;
+}
+
+int AudioToScoreAligner::getLikelihoodModelVersion()
+{
+    return LIKELIHOOD_MODEL_VERSION;
+}
+
+double AudioToScoreAligner::calculateLikelihood(int frame, int event) const
+{
+    m_stats.count(AlignmentStats::LikelihoodEvaluations);
+    const EventTemplates::SparseLogTemplate* sparse = nullptr;
+    if (!m_denseLikelihoods && frame < int(m_baselineScores.size())) {
+        sparse = &m_model->getSparseLogTemplate(event);
+    }
+
+    if (!sparse || sparse->dense) {
+        const double* logTemplate = m_model->getLogTemplate(event);
         double score = 0;
 
         for (int bin = 0; bin < m_dataFeatures[frame].size(); bin++) {
-            score += m_dataFeatures[frame][bin]*log(eventList[event].eventTemplate[bin]);
+            score += m_dataFeatures[frame][bin]*logTemplate[bin];
+        }
+        return exp(score);
+    }
+
+    // The same sum, as the frame's baseline score plus the event's
+    // correction over the few bins where it differs from the baseline
+    const DataSpectrum& spectrum = m_dataFeatures[frame];
+    double score = m_baselineScores[frame];
+    for (size_t i = 0; i < sparse->bins.size(); i++) {
+        score += spectrum[sparse->bins[i]]*sparse->corrections[i];
+    }
+    return exp(score);
+}
+
+void AudioToScoreAligner::setDenseLikelihoods(bool dense)
+{
+    if (dense != m_denseLikelihoods) {
+        m_denseLikelihoods = dense;
+        m_likelihoods.clear();
+        m_likelihoodCache.reset(); // as they are kept separately
+        m_results.clear();
+    }
+}
+
+void AudioToScoreAligner::setPriority(ThreadPool::Priority priority)
+{
+    m_priority = priority;
+}
+
+ThreadPool::Priority AudioToScoreAligner::getPriority() const
+{
+    return m_priority;
+}
+
+void AudioToScoreAligner::setPersistentLikelihoods(bool persist)
+{
+    if (persist != m_persistLikelihoods) {
+        m_persistLikelihoods = persist;
+        m_likelihoods.clear(); // to open or close the cache with them
+    }
+}
+
+void AudioToScoreAligner::setCoarseFactor(int factor)
+{
+    if (factor < 1) factor = 1;
+    if (factor != m_coarseFactor) {
+        m_coarseFactor = factor;
+        m_corridor.clear();
+        m_likelihoods.clear();
+        m_results.clear();
+    }
+}
+
+const AudioToScoreAligner::Corridor& AudioToScoreAligner::getCorridor() const
+{
+    return m_corridor;
+}
+
+void AudioToScoreAligner::setTempoBand(double width, double ratio, bool rescale)
+{
+    if (width != m_bandWidth || ratio != m_bandRatio || rescale != m_bandRescale) {
+        m_bandWidth = width;
+        m_bandRatio = ratio;
+        m_bandRescale = rescale;
+        m_corridor.clear();
+        m_likelihoods.clear();
+        m_results.clear();
+    }
+}
+
+void AudioToScoreAligner::initializeCorridor()
+{
+    int frames = m_dataFeatures.size();
+    bool banded = (m_bandWidth >= 0);
+    if ((m_coarseFactor <= 1 && !banded) || frames == 0) {
+        m_corridor.clear();
+        return;
+    }
+    if (int(m_corridor.size()) == frames) {
+        return; // already have it
+    }
+
+    m_likelihoods.clear(); // as they are stored according to the corridor
+    m_corridor.clear();
+    if (m_coarseFactor > 1) {
+        m_corridor = getCoarseCorridor();
+    }
+    if (banded) {
+        Corridor band = getTempoBand();
+        if (m_corridor.empty()) {
+            m_corridor = band;
+        } else {
+            for (int frame = 0; frame < frames; frame++) {
+                m_corridor[frame].first = std::max(m_corridor[frame].first, band[frame].first);
+                m_corridor[frame].second = std::min(m_corridor[frame].second, band[frame].second);
+            }
         }
-        m_likelihoods[frame][event].likelihood = exp(score);
-        m_likelihoods[frame][event].calculated = true;
     }
+}
+
+AudioToScoreAligner::Corridor AudioToScoreAligner::getCoarseCorridor() const
+{
+    int frames = m_dataFeatures.size();
+
+    // Align frames pooled m_coarseFactor at a time. The coarser hop
+    // gives a coarser state graph, with fewer micro states per event.
+    AudioToScoreAligner coarse(m_model->withHopSize(m_hopSize * m_coarseFactor));
+    coarse.setEventRange(m_startEvent, m_endEvent);
+    coarse.setTempoBand(m_bandWidth, m_bandRatio, m_bandRescale);
+    coarse.setPriority(m_priority);
+    for (int frame = 0; frame < frames; frame += m_coarseFactor) {
+        int end = std::min(frame + m_coarseFactor, frames);
+        DataSpectrum pooled(m_dataFeatures[frame].size(), 0.f);
+        for (int f = frame; f < end; f++) {
+            for (int bin = 0; bin < int(pooled.size()); bin++) {
+                pooled[bin] += m_dataFeatures[f][bin] / (end - frame);
+            }
+        }
+        coarse.supplyFeature(pooled);
+    }
+    coarse.initializeCorridor();
+    coarse.initializeLikelihoods();
+    SimpleHMM hmm = SimpleHMM(coarse);
+    Corridor coarseCorridor = hmm.getPosteriorCorridor(COARSE_POSTERIOR_THRESHOLD);
+    m_stats.add(coarse.m_stats);
+
+    // Widen it by a coarse frame and a few events either way, and map
+    // it back to full resolution
+    int coarseFrames = coarseCorridor.size();
+    Corridor corridor;
+    for (int frame = 0; frame < frames; frame++) {
+        int c = frame / m_coarseFactor;
+        int lowest = m_endEvent;
+        int highest = m_startEvent - 1;
+        for (int i = std::max(c - 1, 0); i <= std::min(c + 1, coarseFrames - 1); i++) {
+            lowest = std::min(lowest, coarseCorridor[i].first);
+            highest = std::max(highest, coarseCorridor[i].second);
+        }
+        lowest = std::max(lowest - COARSE_EVENT_MARGIN, m_startEvent - 1);
+        highest = std::min(highest + COARSE_EVENT_MARGIN, m_endEvent);
+        corridor.push_back({ lowest, highest });
+    }
+
+    LOG_DEBUG("AudioToScoreAligner::getCoarseCorridor: coarse pass over "
+             << coarseFrames << " frames (factor " << m_coarseFactor << ")");
 
-    return m_likelihoods[frame][event].likelihood;
+    return corridor;
+}
+
+AudioToScoreAligner::Corridor AudioToScoreAligner::getTempoBand() const
+{
+    int frames = m_dataFeatures.size();
+    const Score& score = getScore();
+
+    // Nominal start and end times of each position: the silence before
+    // the range, each event in it, and the silence after it
+    int positions = m_endEvent - m_startEvent + 2;
+    vector<double> starts(positions), ends(positions);
+    starts[0] = -HUGE_VAL;
+    ends[0] = 0.;
+    double origin = score.getEventSeconds(m_startEvent);
+    for (int event = m_startEvent; event < m_endEvent; event++) {
+        int position = event - m_startEvent + 1;
+        starts[position] = score.getEventSeconds(event) - origin;
+        ends[position] = score.getEventSeconds(event + 1) - origin;
+    }
+    double secs = score.getEventSeconds(m_endEvent) - origin;
+    starts[positions - 1] = secs;
+    ends[positions - 1] = HUGE_VAL;
+
+    double scale = 1.;
+    if (m_bandRescale && secs > 0.) {
+        scale = (frames * double(m_hopSize) / m_inputSampleRate) / secs;
+    }
+
+    // Both edges of the band only move forwards, so one sweep will do
+    Corridor band;
+    int lowest = 0;
+    int highest = 0;
+    for (int frame = 0; frame < frames; frame++) {
+        double t = frame * double(m_hopSize) / m_inputSampleRate;
+        while (lowest + 1 < positions &&
+               ends[lowest] * scale * (1. + m_bandRatio) + m_bandWidth < t) {
+            lowest++;
+        }
+        while (highest + 1 < positions &&
+               starts[highest + 1] * scale / (1. + m_bandRatio) - m_bandWidth <= t) {
+            highest++;
+        }
+        band.push_back({ m_startEvent - 1 + lowest, m_startEvent - 1 + highest });
+    }
+    return band;
 }
 
 AudioToScoreAligner::AlignmentResults AudioToScoreAligner::align()
 {
-    initializeLikelihoods(); // all zeros
-    AlignmentResults results;
+    m_results.clear();
+    return realign(Anchors());
+}
 
-    SimpleHMM hmm = SimpleHMM(*this); // build state graph
-    results = hmm.getAlignmentResults();
+// Split the range into segments at the anchors. A segment between two
+// anchors starts with the first anchored event and ends just before
+// the second.
+static vector<SimpleHMM::Segment> getSegments(const AudioToScoreAligner::Anchors& anchors,
+    int startEvent, int endEvent, int frames)
+{
+    vector<SimpleHMM::Segment> segments;
+    int event = startEvent;
+    int frame = 0;
+    SimpleHMM::Boundary boundary = SimpleHMM::Free;
+    for (const auto& anchor : anchors) {
+        segments.push_back(SimpleHMM::Segment(event, anchor.first,
+            frame, anchor.second, boundary, SimpleHMM::Onset));
+        event = anchor.first;
+        frame = anchor.second;
+        boundary = SimpleHMM::Onset;
+    }
+    segments.push_back(SimpleHMM::Segment(event, endEvent,
+        frame, frames, boundary, SimpleHMM::Free));
+    return segments;
+}
+
+// Decode each segment into results, which has one entry per event from
+// startEvent. Segments cover distinct frames, so their likelihoods are
+// cached in distinct rows and they can be decoded at the same time.
+static void alignSegments(AudioToScoreAligner& aligner,
+    const vector<SimpleHMM::Segment>& segments, int startEvent,
+    AudioToScoreAligner::AlignmentResults& results)
+{
+    runInParallel(segments.size(), [&](int i) {
+        const SimpleHMM::Segment& segment = segments[i];
+        int first = segment.startEvent - startEvent;
+        int count = segment.endEvent - segment.startEvent;
+        AudioToScoreAligner::AlignmentResults segmentResults;
+        if (segment.start == SimpleHMM::Onset && count == 1) {
+            segmentResults.push_back(segment.startFrame);
+        } else {
+            SimpleHMM hmm = SimpleHMM(aligner, segment); // build state graph
+            segmentResults = hmm.getAlignmentResults();
+        }
+        for (int j = 0; j < count; j++) {
+            // A segment starting Within an event leaves that event's
+            // onset to the segment before
+            if (segmentResults[j] >= 0) results[first + j] = segmentResults[j];
+        }
+    }, aligner.getPriority());
+}
 
+AudioToScoreAligner::AlignmentResults AudioToScoreAligner::realign(const Anchors& anchors)
+{
+    int frames = m_dataFeatures.size();
+    if (frames == 0 || m_startEvent == m_endEvent) {
+        LOG_WARNING("AudioToScoreAligner::realign: nothing to align");
+        return AlignmentResults();
+    }
+
+    // Anchors must lie within the range and be in order in time
+    Anchors validAnchors;
+    int lastFrame = -1;
+    for (const auto& anchor : anchors) {
+        if (anchor.first < m_startEvent || anchor.first >= m_endEvent ||
+            anchor.second <= lastFrame || anchor.second >= frames) {
+            LOG_WARNING("AudioToScoreAligner::realign: ignoring anchor at event "
+                        << anchor.first << ", frame " << anchor.second);
+            continue;
+        }
+        validAnchors[anchor.first] = anchor.second;
+        lastFrame = anchor.second;
+    }
+
+    initializeCorridor();
+    initializeLikelihoods(); // all zeros, unless kept from last time
+
+    vector<SimpleHMM::Segment> previous;
+    if (int(m_results.size()) == m_endEvent - m_startEvent) {
+        previous = getSegments(m_anchors, m_startEvent, m_endEvent, frames);
+    }
+
+    AlignmentResults results(m_endEvent - m_startEvent, 0);
+    vector<SimpleHMM::Segment> changed;
+    for (const auto& segment : getSegments(validAnchors, m_startEvent, m_endEvent, frames)) {
+        int first = segment.startEvent - m_startEvent;
+        int count = segment.endEvent - segment.startEvent;
+        if (count == 0) {
+            continue;
+        }
+        if (std::find(previous.begin(), previous.end(), segment) != previous.end()) {
+            std::copy(m_results.begin() + first, m_results.begin() + first + count,
+                      results.begin() + first);
+            continue;
+        }
+        changed.push_back(segment);
+    }
+    alignSegments(*this, changed, m_startEvent, results);
+
+    LOG_DEBUG("AudioToScoreAligner::realign: recomputed " << changed.size()
+             << " segment(s) for " << validAnchors.size() << " anchor(s)");
+
+    storeLikelihoods();
+
+    m_anchors = validAnchors;
+    m_results = results;
     return results;
+}
 
-/*
-    // Maximum Likelihood Method:
+AudioToScoreAligner::AlignmentResults AudioToScoreAligner::alignInParallel()
+{
+    int frames = m_dataFeatures.size();
+    if (frames == 0 || m_startEvent == m_endEvent) {
+        LOG_WARNING("AudioToScoreAligner::alignInParallel: nothing to align");
+        return AlignmentResults();
+    }
+
+    initializeCorridor();
+    initializeLikelihoods(); // all zeros, unless kept from last time
+
+    // The first pass caches most of the likelihoods the segments need
+    SimpleHMM firstPass = SimpleHMM(*this);
+    firstPass.setBeamWidth(FIRST_PASS_BEAM_WIDTH);
+    Anchors points = firstPass.getConfidentPoints(CONFIDENT_POSTERIOR);
+
+    // Split at confident points no closer than MIN_SEGMENT_FRAMES
+    vector<SimpleHMM::Segment> segments;
+    int event = m_startEvent;
     int frame = 0;
-    for (const auto& feature: m_dataFeatures) {
-        int maxEvent = 0;
-        double maxL = 0;
-        for (int event = 0; event < m_score.getMusicalEvents().size(); event++) {
-            double l = getLikelihood(frame, event);
-            if (l > maxL) {
-                maxL = l;
-                maxEvent = event;
-            }
+    SimpleHMM::Boundary boundary = SimpleHMM::Free;
+    for (const auto& point : points) {
+        if (point.first <= event || point.second - frame < MIN_SEGMENT_FRAMES ||
+            frames - point.second < MIN_SEGMENT_FRAMES) {
+            continue;
         }
-        results.push_back(maxEvent);
-        frame++;
+        segments.push_back(SimpleHMM::Segment(event, point.first + 1,
+            frame, point.second, boundary, SimpleHMM::Within));
+        event = point.first;
+        frame = point.second;
+        boundary = SimpleHMM::Within;
     }
+    segments.push_back(SimpleHMM::Segment(event, m_endEvent,
+        frame, frames, boundary, SimpleHMM::Free));
+
+    LOG_DEBUG("AudioToScoreAligner::alignInParallel: " << points.size()
+             << " confident point(s), " << segments.size() << " segment(s)");
+
+    AlignmentResults results(m_endEvent - m_startEvent, 0);
+    alignSegments(*this, segments, m_startEvent, results);
+
+    storeLikelihoods();
 
+    // There are no anchors, but the segments differ from those of an
+    // unanchored alignment, so nothing can be reused by realign()
+    m_anchors.clear();
+    m_results.clear();
+    return results;
+}
+
+vector<AudioToScoreAligner::AlignmentResults>
+AudioToScoreAligner::alignBatch(std::shared_ptr<const ScoreModel> model,
+                                vector<DataFeatures> recordings,
+                                ThreadPool::Priority priority)
+{
+    vector<AlignmentResults> results(recordings.size());
+    if (recordings.size() > 1) {
+        // Each recording would otherwise build much the same templates
+        model->precomputeTemplates(priority);
+    }
+    runInParallel(recordings.size(), [&](int i) {
+        AudioToScoreAligner aligner(model);
+        aligner.setPriority(priority);
+        aligner.m_dataFeatures = std::move(recordings[i]);
+        results[i] = aligner.align();
+    }, priority);
     return results;
-*/
 }
 
 float AudioToScoreAligner::getSampleRate() const
@@ -192,12 +704,33 @@ float AudioToScoreAligner::getHopSize() const
     return m_hopSize;
 }
 
-Score AudioToScoreAligner::getScore() const
+const Score& AudioToScoreAligner::getScore() const
 {
-    return m_score;
+    static const Score noScore;
+    return m_model ? m_model->getScore() : noScore;
 }
 
-AudioToScoreAligner::DataFeatures AudioToScoreAligner::getDataFeatures() const
+const AudioToScoreAligner::DataFeatures& AudioToScoreAligner::getDataFeatures() const
 {
     return m_dataFeatures;
 }
+
+int AudioToScoreAligner::getFrameCount() const
+{
+    return m_dataFeatures.size();
+}
+
+AlignmentStats& AudioToScoreAligner::getStats() const
+{
+    return m_stats;
+}
+
+AlignmentStats::Values AudioToScoreAligner::getStatistics() const
+{
+    AlignmentStats::Values values = m_stats.getValues();
+    if (m_model) {
+        AlignmentStats::Values modelValues = m_model->getStatistics();
+        values.insert(values.end(), modelValues.begin(), modelValues.end());
+    }
+    return values;
+}
@@ -6,19 +6,30 @@
 #define AUDIO_TO_SCORE_ALIGNER_H
 
 
+#include "AlignmentStats.h"
 #include "Score.h"
-#include "vamp-sdk/Plugin.h"
+#include "ThreadPool.h"
 
+#include <map>
+#include <memory>
+#include <utility>
 #include <vector>
 
+using std::map;
 using std::vector;
 
+class LikelihoodCache;
+class ScoreModel;
 
 
 class AudioToScoreAligner
 {
 public:
     AudioToScoreAligner(float inputSampleRate, int hopSize);
+
+    // Align against an already-loaded score model, which may be
+    // shared with other aligners
+    AudioToScoreAligner(std::shared_ptr<const ScoreModel> model);
     ~AudioToScoreAligner();
 
 /*
@@ -38,25 +49,122 @@ public:
 
     //typedef std::vector<Vamp::RealTime> AlignmentResults;
     typedef vector<int> AlignmentResults;
+    typedef map<int, int> Anchors; // event index -> frame at which it begins
+
+    // For each frame, the lowest and highest events that may be
+    // occupied, with the silent states before and after the aligned
+    // range counting as the events either side of it
+    typedef vector<std::pair<int, int>> Corridor;
 
     bool loadAScore(string scoreName, int blockSize);
+    std::shared_ptr<const ScoreModel> getModel() const;
+
+    // Restrict alignment to the events in [startEvent, endEvent). By
+    // default all events in the score are aligned. Results from
+    // align() then have one entry per event in the range.
+    void setEventRange(int startEvent, int endEvent);
+    int getStartEvent() const;
+    int getEndEvent() const;
+
     void supplyFeature(DataSpectrum s);
     AlignmentResults align();
+
+    // Align again with the given events fixed at the given frames,
+    // e.g. after a user has corrected some onsets. The likelihoods and
+    // results of the previous alignment are kept, and only those
+    // segments between neighbouring anchors that differ from the last
+    // call are recomputed.
+    AlignmentResults realign(const Anchors& anchors);
+
+    // Align by first finding points where the alignment is confidently
+    // within a single event, using a cheap narrow-beam pass, and then
+    // splitting there and decoding the segments in parallel.
+    AlignmentResults alignInParallel();
+
+    // Align each of several recordings against the same model, all at
+    // once. Only the work that depends on the audio is done for each.
+    static vector<AlignmentResults> alignBatch(std::shared_ptr<const ScoreModel> model,
+                                               vector<DataFeatures> recordings,
+                                               ThreadPool::Priority priority = ThreadPool::Normal);
+
+    // Align first with frames pooled factor at a time, and then at full
+    // resolution only within a corridor around the coarse alignment. A
+    // factor of 1 (the default) aligns at full resolution throughout.
+    void setCoarseFactor(int factor);
+    const Corridor& getCorridor() const; // empty if unconstrained
+
+    // Only allow each event within a band around its nominal time from
+    // the score's tempo markings: within width seconds, widened further
+    // by ratio times the elapsed time to allow for tempo deviation. If
+    // rescale is true the nominal timeline is first stretched to the
+    // length of the audio. A negative width (the default) disables it.
+    void setTempoBand(double width, double ratio, bool rescale);
+
+    // Calculate each likelihood as a full dot product with the event's
+    // log-template, rather than from the frame's baseline score plus a
+    // sparse correction. Slower; the results should agree to rounding,
+    // so this is for validating the sparse form.
+    void setDenseLikelihoods(bool dense);
+
+    // Keep the likelihoods calculated on disk, under the recording,
+    // score and feature geometry, and reuse those kept by earlier runs,
+    // so that a run with other settings calculates only the ones none
+    // of them did (see LikelihoodCache). Off by default.
+    void setPersistentLikelihoods(bool persist);
+
+    // The version of the likelihood calculation, which anything kept
+    // elsewhere that was derived from likelihoods should also depend on
+    static int getLikelihoodModelVersion();
+
+    // The priority of this aligner's work in the shared thread pool,
+    // relative to that of other aligners in the process
+    void setPriority(ThreadPool::Priority priority);
+    ThreadPool::Priority getPriority() const;
+
     float getSampleRate() const;
     float getHopSize() const;
-    Score getScore() const;
-    DataFeatures getDataFeatures() const;
+    const Score& getScore() const;
+    const DataFeatures& getDataFeatures() const;
+    int getFrameCount() const;
     double getLikelihood(int frameIndex, int eventIndex);
 
+    // Timings and counters for this aligner's work so far, including
+    // that of any coarse pass. getStatistics() adds the model's own.
+    AlignmentStats& getStats() const;
+    AlignmentStats::Values getStatistics() const;
+
 private:
     float m_inputSampleRate;
     int m_hopSize;
-    Score m_score;
+    std::shared_ptr<const ScoreModel> m_model;
+    int m_startEvent;
+    int m_endEvent;
     DataLikelihoods m_likelihoods;
+    vector<int> m_likelihoodStart; // event stored first in each frame
+    vector<map<int, double>> m_outsideLikelihoods; // of each frame, by event, outside the corridor
     DataLikelihoods m_silenceLikelihoods;
     DataFeatures m_dataFeatures;
+    Anchors m_anchors; // as used for m_results
+    AlignmentResults m_results; // from the last align() or realign()
+    int m_coarseFactor;
+    double m_bandWidth;
+    double m_bandRatio;
+    bool m_bandRescale;
+    Corridor m_corridor;
+    bool m_denseLikelihoods;
+    ThreadPool::Priority m_priority;
+    bool m_persistLikelihoods;
+    std::unique_ptr<LikelihoodCache> m_likelihoodCache; // null unless persisting
+    vector<double> m_baselineScores; // of each frame, see calculateLikelihood
+    mutable AlignmentStats m_stats;
 
     void initializeLikelihoods();
+    void openLikelihoodCache();
+    void storeLikelihoods();
+    void initializeCorridor();
+    Corridor getCoarseCorridor() const;
+    Corridor getTempoBand() const;
+    double calculateLikelihood(int frame, int event) const;
 };
 
 #endif
@@ -0,0 +1,119 @@
+/*
+  A hash of everything some cached result depends on.
+*/
+
+#include "CacheKey.h"
+
+#include <cstring>
+
+// Two 64-bit lanes over 8-byte words: FNV-1a, and a multiply-rotate
+// round as in xxHash, each with a final mix. Neither need resist an
+// adversary; together they make an accidental clash vanishingly rare.
+static const uint64_t FNV_OFFSET = 14695981039346656037ull;
+static const uint64_t FNV_PRIME = 1099511628211ull;
+static const uint64_t PRIME_1 = 11400714785074694791ull;
+static const uint64_t PRIME_2 = 14029467366897019727ull;
+
+static inline uint64_t rotateLeft(uint64_t x, int bits)
+{
+    return (x << bits) | (x >> (64 - bits));
+}
+
+static inline uint64_t mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+CacheKey::CacheKey()
+{
+    m_hash[0] = FNV_OFFSET;
+    m_hash[1] = PRIME_1;
+}
+
+void CacheKey::add(const void* data, size_t bytes)
+{
+    const char* p = static_cast<const char*>(data);
+    uint64_t a = m_hash[0], b = m_hash[1];
+    auto addWord = [&](uint64_t word) {
+        a = (a ^ word) * FNV_PRIME;
+        b = rotateLeft(b + word * PRIME_2, 31) * PRIME_1;
+    };
+    size_t i = 0;
+    for (; i + 8 <= bytes; i += 8) {
+        uint64_t word;
+        memcpy(&word, p + i, 8);
+        addWord(word);
+    }
+    uint64_t tail = 0;
+    if (i < bytes) memcpy(&tail, p + i, bytes - i);
+    addWord(tail);
+    addWord(bytes); // so that where one piece ends counts
+    m_hash[0] = a;
+    m_hash[1] = b;
+}
+
+void CacheKey::add(const string& s)
+{
+    add(s.data(), s.size());
+}
+
+void CacheKey::addScore(const Score& score)
+{
+    const Score::MusicalEventList& events = score.getMusicalEvents();
+    add(double(events.size()));
+    for (int event = 0; event < int(events.size()); event++) {
+        const Score::MusicalEvent& e = events[event];
+        int32_t fields[] = {
+            e.measureInfo.measureNumber,
+            e.measureInfo.measurePosition.numerator,
+            e.measureInfo.measurePosition.denominator,
+            e.duration.numerator,
+            e.duration.denominator,
+            e.meterNumer,
+            e.meterDenom,
+            int32_t(e.notes.size())
+        };
+        add(fields, sizeof(fields));
+        for (const auto& note : e.notes) {
+            add(double(note.isNewNote ? -note.midiNumber - 1 : note.midiNumber));
+        }
+        add(e.tempo);
+        add(score.getEventSeconds(event));
+    }
+    for (const auto& change : score.getTempoChanges()) {
+        add(change.measureInfo.measureNumber);
+        add(change.measureInfo.measurePosition.getValue());
+        add(change.newTempo);
+        add(change.noteLength);
+    }
+    for (const auto& change : score.getMeterChanges()) {
+        add(change.measureNumber);
+        add(change.numer);
+        add(change.denom);
+    }
+}
+
+void CacheKey::addFeatures(const AudioToScoreAligner::DataFeatures& features)
+{
+    add(double(features.size()));
+    for (const auto& feature : features) {
+        add(feature.data(), feature.size() * sizeof(feature[0]));
+    }
+}
+
+string CacheKey::getName() const
+{
+    static const char* digits = "0123456789abcdef";
+    string name;
+    for (uint64_t hash : { mix(m_hash[0]), mix(m_hash[1]) }) {
+        for (int shift = 60; shift >= 0; shift -= 4) {
+            name += digits[(hash >> shift) & 15];
+        }
+    }
+    return name;
+}
@@ -0,0 +1,45 @@
+/*
+  A hash of everything some cached result depends on, built up piece
+  by piece, naming the file it is cached in (see DiskCache).
+*/
+
+#ifndef CACHE_KEY_H
+#define CACHE_KEY_H
+
+#include "AudioToScoreAligner.h"
+#include "Score.h"
+
+#include <cstdint>
+#include <string>
+
+using std::string;
+
+
+class CacheKey
+{
+public:
+    CacheKey();
+
+    // The same pieces in the same order give the same key
+    void add(const void* data, size_t bytes);
+    void add(const string& s);
+    void add(double value) { add(&value, sizeof(value)); } // also for ints
+
+    void addScore(const Score& score);
+    void addFeatures(const AudioToScoreAligner::DataFeatures& features);
+
+    // As 32 hex digits
+    string getName() const;
+
+    // The full 128 bits, for checking against a copy kept in the file
+    uint64_t getHash(int lane) const { return m_hash[lane]; }
+
+    bool operator==(const CacheKey& other) const {
+        return m_hash[0] == other.m_hash[0] && m_hash[1] == other.m_hash[1];
+    }
+
+private:
+    uint64_t m_hash[2];
+};
+
+#endif
@@ -0,0 +1,123 @@
+/*
+  A folder of cached files, bounded in size.
+*/
+
+#include "DiskCache.h"
+#include "Log.h"
+#include "Paths.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <vector>
+
+using std::filesystem::path;
+
+
+DiskCache::DiskCache(string folder, string extension, const char* sizeVariable,
+                     uint64_t defaultMegabytes) :
+    m_extension{extension}, m_maxBytes{defaultMegabytes << 20}
+{
+    const char* value = getenv(sizeVariable);
+    if (value && *value) {
+        char* end = nullptr;
+        long long megabytes = strtoll(value, &end, 10);
+        if (*end != '\0' || megabytes < 0) {
+            LOG_WARNING("DiskCache: ignoring " << sizeVariable << " \"" << value << "\"");
+        } else {
+            m_maxBytes = uint64_t(megabytes) << 20;
+        }
+    }
+    if (m_maxBytes == 0) return; // disabled
+    path dir = Paths::getCacheDirectory();
+    if (!dir.empty()) m_dir = dir / folder;
+}
+
+DiskCache::DiskCache(path dir, string extension, uint64_t maxBytes) :
+    m_dir{dir}, m_extension{extension}, m_maxBytes{maxBytes}
+{
+}
+
+bool DiskCache::isEnabled() const
+{
+    return !m_dir.empty();
+}
+
+path DiskCache::getPath(const CacheKey& key) const
+{
+    return m_dir / (key.getName() + m_extension);
+}
+
+void DiskCache::touch(const CacheKey& key) const
+{
+    std::error_code ec;
+    std::filesystem::last_write_time(getPath(key),
+                                     std::filesystem::file_time_type::clock::now(), ec);
+}
+
+bool DiskCache::write(const CacheKey& key, const string& contents) const
+{
+    if (m_dir.empty()) return false;
+    std::error_code ec;
+    std::filesystem::create_directories(m_dir, ec);
+
+    // Write to a temporary file and rename it into place, so that
+    // nobody ever reads a half-written file, and anyone with the old
+    // one mapped keeps it intact
+    path p = getPath(key);
+    path tempPath = p;
+    tempPath += "." + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out || !out.write(contents.data(), contents.size())) {
+            LOG_WARNING("DiskCache: unable to write " << tempPath);
+            out.close();
+            std::filesystem::remove(tempPath, ec);
+            return false;
+        }
+    }
+    std::filesystem::rename(tempPath, p, ec);
+    if (ec) {
+        LOG_WARNING("DiskCache: unable to replace " << p << ": " << ec.message());
+        std::filesystem::remove(tempPath, ec);
+        return false;
+    }
+
+    evict(p);
+    return true;
+}
+
+void DiskCache::evict(const path& keep) const
+{
+    struct Entry {
+        path p;
+        std::filesystem::file_time_type used;
+        uint64_t bytes;
+    };
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+    std::error_code ec;
+    for (const auto& item : std::filesystem::directory_iterator(m_dir, ec)) {
+        if (item.path().extension() != m_extension) continue;
+        std::error_code itemError;
+        Entry entry { item.path(), item.last_write_time(itemError), item.file_size(itemError) };
+        if (itemError) continue;
+        total += entry.bytes;
+        if (entry.p != keep) entries.push_back(entry);
+    }
+    if (total <= m_maxBytes) return;
+
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry& a, const Entry& b) { return a.used < b.used; });
+    int evicted = 0;
+    for (const auto& entry : entries) {
+        if (total <= m_maxBytes) break;
+        if (std::filesystem::remove(entry.p, ec)) {
+            total -= entry.bytes;
+            evicted++;
+        }
+    }
+    LOG_DEBUG("DiskCache: evicted " << evicted << " file(s) from " << m_dir
+              << ", leaving " << total << " bytes");
+}
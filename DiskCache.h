@@ -0,0 +1,51 @@
+/*
+  A folder of files in the user's cache directory, each named by a
+  CacheKey, kept within a size bound by evicting the least recently
+  used files first. A file's modification time records its last use.
+*/
+
+#ifndef DISK_CACHE_H
+#define DISK_CACHE_H
+
+#include "CacheKey.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+using std::string;
+
+
+class DiskCache
+{
+public:
+    // The named folder in Paths::getCacheDirectory(), bounded to the
+    // number of megabytes in the environment variable sizeVariable, or
+    // defaultMegabytes if that is unset. Disabled if the bound is 0, or
+    // if there is no cache directory.
+    DiskCache(string folder, string extension, const char* sizeVariable,
+              uint64_t defaultMegabytes);
+
+    DiskCache(std::filesystem::path dir, string extension, uint64_t maxBytes);
+
+    bool isEnabled() const;
+
+    std::filesystem::path getPath(const CacheKey& key) const;
+
+    // Mark the file for key as just used
+    void touch(const CacheKey& key) const;
+
+    // Replace the file for key with these contents, then evict files
+    // until the folder is within its bound again. Returns false if the
+    // file could not be written, which is not otherwise an error.
+    bool write(const CacheKey& key, const string& contents) const;
+
+private:
+    std::filesystem::path m_dir; // empty if disabled
+    string m_extension;
+    uint64_t m_maxBytes;
+
+    void evict(const std::filesystem::path& keep) const;
+};
+
+#endif
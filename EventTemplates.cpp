@@ -0,0 +1,287 @@
+/*
+  The log-templates of a score's events at one feature geometry. They
+  are built from the sparse note templates the first time each one is
+  asked for, unless they were already built in full (e.g. mapped from
+  the score cache), so that a partial alignment pays only for the
+  events its beam visits.
+*/
+
+#include "EventTemplates.h"
+#include "Parallel.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <new>
+
+
+// The proportion of an event template given over to a flat background
+static const double EVENT_BACKGROUND = 0.05;
+
+// A sparse correction touching more than this proportion of the bins
+// costs more (being gathered rather than contiguous) than the dense dot
+static const double MAX_SPARSE_PROPORTION = 0.4;
+
+static double* allocateRow(int stride)
+{
+    return static_cast<double*>(::operator new(stride * sizeof(double),
+        std::align_val_t(ScoreCache::TEMPLATE_ALIGNMENT)));
+}
+
+static void freeRow(double* row)
+{
+    ::operator delete(row, std::align_val_t(ScoreCache::TEMPLATE_ALIGNMENT));
+}
+
+EventTemplates::EventTemplates(const Score& score, float sampleRate, int blockSize) :
+    m_bins{0}, m_stride{0}, m_count{0}, m_built{0}, m_buildNanoseconds{0}
+{
+    m_notes = &CreateNoteTemplates::getSparseNoteTemplates(sampleRate, blockSize);
+    m_bins = m_notes->binCount;
+    const int perAlignment = ScoreCache::TEMPLATE_ALIGNMENT / sizeof(double);
+    m_stride = (m_bins + perAlignment - 1) / perAlignment * perAlignment;
+
+    // Events whose notes are the same (in the same order) share a row
+    Score::EventArrays events = score.getEventArrays();
+    std::map<vector<int32_t>, int32_t> rows;
+    m_rowNoteStart.push_back(0);
+    for (int event = 0; event < events.count; event++) {
+        const int32_t* midis = events.noteMidi + events.noteStart[event];
+        vector<int32_t> key(midis, midis + (events.noteStart[event + 1] - events.noteStart[event]));
+        auto itr = rows.find(key);
+        if (itr == rows.end()) {
+            itr = rows.insert({ key, int32_t(rows.size()) }).first;
+            m_rowNotes.insert(m_rowNotes.end(), key.begin(), key.end());
+            m_rowNoteStart.push_back(m_rowNotes.size());
+        }
+        m_eventRows.push_back(itr->second);
+    }
+    m_count = rows.size();
+
+    m_rows.reset(new std::atomic<double*>[m_count]);
+    for (int row = 0; row < m_count; row++) {
+        m_rows[row].store(nullptr);
+    }
+
+    initializeBaseline(*m_notes);
+}
+
+EventTemplates::EventTemplates(const ScoreCache::Templates& templates,
+                               float sampleRate, int blockSize) :
+    m_bins{templates.bins}, m_stride{templates.stride}, m_count{templates.count},
+    m_complete{templates}, m_notes{nullptr}, m_built{templates.count},
+    m_buildNanoseconds{0}
+{
+    initializeBaseline(CreateNoteTemplates::getSparseNoteTemplates(sampleRate, blockSize));
+}
+
+EventTemplates::~EventTemplates()
+{
+    for (int row = 0; row < m_count; row++) {
+        if (m_rows) {
+            double* p = m_rows[row].load();
+            if (p) freeRow(p);
+        }
+        delete m_sparseRows[row].load();
+    }
+}
+
+void EventTemplates::initializeBaseline(const SparseNoteTemplates& notes)
+{
+    // Every bin of a template not under a peak is the same function
+    // of the background, so take the logs of those once
+    for (int bin = 0; bin < m_bins; bin++) {
+        m_logBackground.push_back(log(EVENT_BACKGROUND / m_bins +
+            (1. - EVENT_BACKGROUND) * notes.backgroundWeight * notes.background[bin]));
+    }
+
+    m_sparseRows.reset(new std::atomic<SparseLogTemplate*>[m_count]);
+    for (int row = 0; row < m_count; row++) {
+        m_sparseRows[row].store(nullptr);
+    }
+}
+
+int EventTemplates::getBinCount() const
+{
+    return m_bins;
+}
+
+int EventTemplates::getTemplateCount() const
+{
+    return m_count;
+}
+
+int EventTemplates::getBuiltCount() const
+{
+    return m_built;
+}
+
+double EventTemplates::getBuildSeconds() const
+{
+    return m_buildNanoseconds.load() * 1e-9;
+}
+
+bool EventTemplates::isComplete() const
+{
+    return m_complete.logTemplates != nullptr;
+}
+
+int EventTemplates::getRow(int event) const
+{
+    if (m_complete.logTemplates) return m_complete.eventTemplates[event];
+    return m_eventRows[event];
+}
+
+const double* EventTemplates::getLogTemplate(int event) const
+{
+    int row = getRow(event);
+    if (m_complete.logTemplates) {
+        return m_complete.logTemplates + size_t(row) * m_stride;
+    }
+    double* p = m_rows[row].load(std::memory_order_acquire);
+    if (!p) p = buildRow(row);
+    return p;
+}
+
+const double* EventTemplates::getBaselineLogTemplate() const
+{
+    return m_logBackground.data();
+}
+
+const EventTemplates::SparseLogTemplate&
+EventTemplates::getSparseLogTemplate(int event) const
+{
+    int row = getRow(event);
+    SparseLogTemplate* sparse = m_sparseRows[row].load(std::memory_order_acquire);
+    if (sparse) return *sparse;
+
+    // The bins away from the peaks are copied from the baseline when
+    // the row is built, so they compare exactly equal to it
+    const double* logTemplate = getLogTemplate(event);
+    sparse = new SparseLogTemplate;
+    for (int bin = 0; bin < m_bins; bin++) {
+        if (logTemplate[bin] != m_logBackground[bin]) {
+            sparse->bins.push_back(bin);
+            sparse->corrections.push_back(logTemplate[bin] - m_logBackground[bin]);
+        }
+    }
+    sparse->dense = (sparse->bins.size() > m_bins * MAX_SPARSE_PROPORTION);
+    if (sparse->dense) {
+        sparse->bins = {};
+        sparse->corrections = {};
+    }
+
+    SparseLogTemplate* expected = nullptr;
+    if (!m_sparseRows[row].compare_exchange_strong(expected, sparse,
+                                                   std::memory_order_acq_rel)) {
+        delete sparse;
+        return *expected;
+    }
+    return *sparse;
+}
+
+double* EventTemplates::buildRow(int row) const
+{
+    // The sparse form of Score::makeEventTemplate: sum the notes'
+    // templates (each peakWeight * peaks + backgroundWeight *
+    // background, or just the background part for a note with no
+    // peaks), normalise, and mix with a flat background
+    auto start = std::chrono::steady_clock::now();
+    const int32_t* midis = m_rowNotes.data() + m_rowNoteStart[row];
+    int count = m_rowNoteStart[row + 1] - m_rowNoteStart[row];
+    vector<const SparseNoteTemplate*> notes;
+    double total = 0.;
+    bool allPeaks = true;
+    for (int n = 0; n < count; n++) {
+        auto itr = m_notes->notes.find(midis[n]);
+        if (itr == m_notes->notes.end()) continue; // outside the piano
+        notes.push_back(&itr->second);
+        total += m_notes->backgroundWeight;
+        if (itr->second.bins.empty()) {
+            allPeaks = false;
+        } else {
+            total += m_notes->peakWeight;
+        }
+    }
+
+    double* p = allocateRow(m_stride);
+    if (total == 0.) {
+        for (int bin = 0; bin < m_bins; bin++) p[bin] = log(1. / m_bins);
+    } else {
+        double background = (1. - EVENT_BACKGROUND) * m_notes->backgroundWeight *
+            notes.size() / total;
+        if (allPeaks) {
+            memcpy(p, m_logBackground.data(), m_bins * sizeof(double));
+        } else {
+            for (int bin = 0; bin < m_bins; bin++) {
+                p[bin] = log(EVENT_BACKGROUND / m_bins + background * m_notes->background[bin]);
+            }
+        }
+        double peak = (1. - EVENT_BACKGROUND) * m_notes->peakWeight / total;
+        vector<double> sum(m_bins, 0.);
+        vector<int> touched;
+        for (const auto* note : notes) {
+            for (size_t i = 0; i < note->bins.size(); i++) {
+                int bin = note->bins[i];
+                if (sum[bin] == 0.) touched.push_back(bin);
+                sum[bin] += note->values[i];
+            }
+        }
+        for (int bin : touched) {
+            p[bin] = log(EVENT_BACKGROUND / m_bins +
+                         background * m_notes->background[bin] + peak * sum[bin]);
+        }
+    }
+    for (int bin = m_bins; bin < m_stride; bin++) p[bin] = 0.;
+    m_buildNanoseconds.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>
+        (std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+
+    // Another thread may have got there first, in which case use theirs
+    double* expected = nullptr;
+    if (!m_rows[row].compare_exchange_strong(expected, p, std::memory_order_acq_rel)) {
+        freeRow(p);
+        return expected;
+    }
+    ++m_built;
+    return p;
+}
+
+void EventTemplates::buildAll(ThreadPool::Priority priority) const
+{
+    if (m_complete.logTemplates) return;
+    runInParallel(m_count, [&](int row) {
+        if (!m_rows[row].load(std::memory_order_acquire)) buildRow(row);
+    }, priority);
+}
+
+ScoreCache::Templates EventTemplates::getAll() const
+{
+    if (m_complete.logTemplates) return m_complete;
+
+    buildAll();
+
+    struct Storage {
+        vector<double> buffer; // with room to align the start
+        vector<int32_t> eventTemplates;
+    };
+    auto storage = std::make_shared<Storage>();
+    const int perAlignment = ScoreCache::TEMPLATE_ALIGNMENT / sizeof(double);
+    storage->buffer.resize(size_t(m_count) * m_stride + perAlignment, 0.);
+    double* base = storage->buffer.data();
+    while (reinterpret_cast<uintptr_t>(base) % ScoreCache::TEMPLATE_ALIGNMENT != 0) ++base;
+    for (int row = 0; row < m_count; row++) {
+        memcpy(base + size_t(row) * m_stride, m_rows[row].load(), m_stride * sizeof(double));
+    }
+    storage->eventTemplates = m_eventRows;
+
+    ScoreCache::Templates templates;
+    templates.bins = m_bins;
+    templates.stride = m_stride;
+    templates.count = m_count;
+    templates.logTemplates = base;
+    templates.eventTemplates = storage->eventTemplates.data();
+    templates.storage = storage;
+    return templates;
+}
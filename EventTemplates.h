@@ -0,0 +1,98 @@
+/*
+  The log-templates of a score's events at one feature geometry. They
+  are built from the sparse note templates the first time each one is
+  asked for, unless they were already built in full (e.g. mapped from
+  the score cache), so that a partial alignment pays only for the
+  events its beam visits.
+*/
+
+#ifndef EVENT_TEMPLATES_H
+#define EVENT_TEMPLATES_H
+
+#include "Score.h"
+#include "ScoreCache.h"
+#include "Templates.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+using std::shared_ptr;
+using std::vector;
+
+
+class EventTemplates
+{
+public:
+    // Templates for the events of the score, built on demand
+    EventTemplates(const Score& score, float sampleRate, int blockSize);
+
+    // Templates already built in full for this geometry
+    EventTemplates(const ScoreCache::Templates& templates, float sampleRate, int blockSize);
+
+    ~EventTemplates();
+
+    int getBinCount() const;
+    int getTemplateCount() const; // distinct templates
+    int getBuiltCount() const; // how many of those have been built
+    double getBuildSeconds() const; // spent building them, in all threads
+    bool isComplete() const; // built in full when constructed
+
+    // The log of an event's template, getBinCount() values starting on
+    // a 64-byte boundary. May be called from several threads at once.
+    const double* getLogTemplate(int event) const;
+
+    // Every log-template is the baseline, the log of the background
+    // shared by all templates, plus a correction that is zero outside
+    // the bins around the harmonics of the event's notes (or, for an
+    // event with a note too high to have any, a dense correction).
+    // Chords can cover most of the spectrum, so the correction is only
+    // kept where it is short enough to be cheaper than the full
+    // log-template.
+    struct SparseLogTemplate {
+        bool dense; // use getLogTemplate() instead
+        vector<int32_t> bins; // in increasing order
+        vector<double> corrections; // log-template minus baseline
+    };
+    const double* getBaselineLogTemplate() const;
+    const SparseLogTemplate& getSparseLogTemplate(int event) const;
+
+    // Build any templates not yet built, in parallel
+    void buildAll(ThreadPool::Priority priority = ThreadPool::Normal) const;
+
+    // All of the templates in one block, as stored in the score cache
+    ScoreCache::Templates getAll() const;
+
+private:
+    EventTemplates(const EventTemplates&) = delete;
+    EventTemplates& operator=(const EventTemplates&) = delete;
+
+    int m_bins;
+    int m_stride;
+    int m_count;
+    vector<int32_t> m_eventRows; // template row for each event
+
+    // When built in full
+    ScoreCache::Templates m_complete;
+
+    // When built on demand: the notes of each row, in a pool
+    const SparseNoteTemplates* m_notes;
+    vector<int32_t> m_rowNoteStart;
+    vector<int32_t> m_rowNotes;
+    std::unique_ptr<std::atomic<double*>[]> m_rows;
+    mutable std::atomic<int> m_built;
+    mutable std::atomic<int64_t> m_buildNanoseconds;
+
+    // The baseline, which is also the whole of a row whose notes all
+    // have peaks, outside those peaks
+    vector<double> m_logBackground;
+    std::unique_ptr<std::atomic<SparseLogTemplate*>[]> m_sparseRows;
+
+    void initializeBaseline(const SparseNoteTemplates& notes);
+    int getRow(int event) const;
+    double* buildRow(int row) const;
+};
+
+#endif
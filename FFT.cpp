@@ -0,0 +1,133 @@
+/*
+  A mixed-radix FFT for real input.
+*/
+
+#include "FFT.h"
+
+#include <cmath>
+
+static const double PI = 3.14159265358979323846;
+
+
+FFT::FFT(int size) :
+    m_size{size}, m_half{size / 2}
+{
+    // Radix 4 first, as it needs the fewest multiplications per point
+    int n = m_half;
+    for (int radix : { 4, 2, 3, 5 }) {
+        while (n % radix == 0) {
+            n /= radix;
+            m_factors.push_back(radix);
+            m_factors.push_back(n);
+        }
+    }
+    for (int radix = 7; n > 1; radix += 2) {
+        while (n % radix == 0) {
+            n /= radix;
+            m_factors.push_back(radix);
+            m_factors.push_back(n);
+        }
+    }
+
+    for (int i = 0; i < m_half; i++) {
+        m_twiddles.push_back(std::polar(1., -2. * PI * i / m_half));
+    }
+    for (int i = 0; i < m_half; i++) {
+        m_realTwiddles.push_back(std::polar(1., -2. * PI * i / m_size));
+    }
+}
+
+int FFT::getSize() const
+{
+    return m_size;
+}
+
+void FFT::forward(const double* input, Complex* output) const
+{
+    // Transform the even and odd samples as the real and imaginary
+    // parts of one complex sequence, and then split the result
+    vector<Complex> packed(m_half), z(m_half);
+    for (int i = 0; i < m_half; i++) {
+        packed[i] = Complex(input[2 * i], input[2 * i + 1]);
+    }
+    if (m_half == 1) {
+        z[0] = packed[0];
+    } else {
+        transform(z.data(), packed.data(), 1, m_factors.data());
+    }
+
+    output[0] = Complex(z[0].real() + z[0].imag(), 0.);
+    output[m_half] = Complex(z[0].real() - z[0].imag(), 0.);
+    for (int k = 1; k < m_half; k++) {
+        Complex a = z[k];
+        Complex b = std::conj(z[m_half - k]);
+        Complex even = (a + b) * 0.5;
+        Complex odd = (a - b) * Complex(0., -0.5);
+        output[k] = even + m_realTwiddles[k] * odd;
+    }
+}
+
+// Decimation in time: transform each of the radix interleaved
+// subsequences into consecutive blocks of out, and then combine them
+void FFT::transform(Complex* out, const Complex* in, int stride, const int* factors) const
+{
+    int radix = factors[0];
+    int length = factors[1];
+    if (length == 1) {
+        for (int q = 0; q < radix; q++) {
+            out[q] = in[q * stride];
+        }
+    } else {
+        for (int q = 0; q < radix; q++) {
+            transform(out + q * length, in + q * stride, stride * radix, factors + 2);
+        }
+    }
+    butterfly(out, stride, radix, length);
+}
+
+void FFT::butterfly(Complex* out, int stride, int radix, int length) const
+{
+    const Complex* tw = m_twiddles.data();
+
+    if (radix == 2) {
+        for (int u = 0; u < length; u++) {
+            Complex t = out[u + length] * tw[u * stride];
+            out[u + length] = out[u] - t;
+            out[u] += t;
+        }
+        return;
+    }
+
+    if (radix == 4) {
+        for (int u = 0; u < length; u++) {
+            Complex a0 = out[u];
+            Complex a1 = out[u + length] * tw[u * stride];
+            Complex a2 = out[u + 2 * length] * tw[2 * u * stride];
+            Complex a3 = out[u + 3 * length] * tw[3 * u * stride];
+            Complex s02 = a0 + a2, d02 = a0 - a2;
+            Complex s13 = a1 + a3, d13 = a1 - a3;
+            Complex d13j(d13.imag(), -d13.real()); // times -i
+            out[u] = s02 + s13;
+            out[u + length] = d02 + d13j;
+            out[u + 2 * length] = s02 - s13;
+            out[u + 3 * length] = d02 - d13j;
+        }
+        return;
+    }
+
+    // Any other radix, as a small DFT of each set of points
+    vector<Complex> scratch(radix);
+    for (int u = 0; u < length; u++) {
+        for (int q = 0; q < radix; q++) {
+            scratch[q] = out[u + q * length];
+        }
+        for (int q = 0; q < radix; q++) {
+            int k = u + q * length;
+            Complex sum = scratch[0];
+            for (int r = 1; r < radix; r++) {
+                sum += scratch[r] * tw[(int64_t(r) * k * stride) % m_half];
+            }
+            out[k] = sum;
+        }
+    }
+}
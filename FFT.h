@@ -0,0 +1,42 @@
+/*
+  A mixed-radix FFT for real input, for block sizes such as 6144 that
+  are not powers of two. Used to compute features from audio outside a
+  Vamp host, which would otherwise do the transform for us.
+*/
+
+#ifndef FFT_H
+#define FFT_H
+
+#include <complex>
+#include <vector>
+
+using std::vector;
+
+
+class FFT
+{
+public:
+    // size must be even. Any size works, but those whose factors are
+    // all 2, 3, 4 or 5 are much the fastest.
+    FFT(int size);
+
+    int getSize() const;
+
+    // Transform size real values into the size/2 + 1 complex bins from
+    // DC to Nyquist. May be called from several threads at once.
+    void forward(const double* input, std::complex<double>* output) const;
+
+private:
+    typedef std::complex<double> Complex;
+
+    int m_size;
+    int m_half; // the real input is transformed as half as many complex values
+    vector<int> m_factors; // of m_half: radix, then the length remaining after it
+    vector<Complex> m_twiddles; // of m_half
+    vector<Complex> m_realTwiddles; // of m_size, for splitting the halves apart
+
+    void transform(Complex* out, const Complex* in, int stride, const int* factors) const;
+    void butterfly(Complex* out, int stride, int radix, int length) const;
+};
+
+#endif
@@ -0,0 +1,177 @@
+/*
+  The exact input to an alignment, for replaying it without a host.
+*/
+
+#include "FeatureCapture.h"
+#include "Log.h"
+#include "MappedFile.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+
+// Bump this whenever the layout below changes
+static const uint32_t CAPTURE_VERSION = 1;
+static const char CAPTURE_MAGIC[8] = { 'P', 'A', 'C', 'A', 'P', 'T', 'U', 'R' };
+static const uint32_t ENDIAN_TAG = 0x01020304;
+static const int IDENTIFIER_LENGTH = 56;
+
+// On-disk layout: the header, the score name, the parameters and then
+// the features, frame by frame, all in native byte order (ENDIAN_TAG
+// rejects a capture from a machine with the other one) and each
+// section starting on an 8-byte boundary.
+
+struct CaptureHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t endianTag;
+    float sampleRate;
+    int32_t hopSize;
+    int32_t blockSize;
+    int32_t startEvent;
+    int32_t endEvent;
+    int32_t coarseFactor;
+    double bandWidth;
+    double bandRatio;
+    double firstFrameTime;
+    uint8_t bandRescale;
+    uint8_t segmentParallel;
+    uint8_t reserved[6];
+    uint32_t scoreNameLength;
+    uint32_t parameterCount;
+    uint32_t frameCount;
+    uint32_t binCount;
+    uint64_t scoreNameOffset;
+    uint64_t parametersOffset;
+    uint64_t featuresOffset;
+};
+
+struct CapturedParameter
+{
+    char identifier[IDENTIFIER_LENGTH]; // null-terminated
+    float value;
+    uint32_t reserved;
+};
+
+static uint64_t alignOffset(std::string& buffer)
+{
+    buffer.resize((buffer.size() + 7) / 8 * 8, '\0');
+    return buffer.size();
+}
+
+void FeatureCapture::configure(AudioToScoreAligner& aligner) const
+{
+    aligner.setEventRange(startEvent, endEvent);
+    aligner.setCoarseFactor(coarseFactor);
+    aligner.setTempoBand(bandWidth, bandRatio, bandRescale);
+}
+
+bool FeatureCapture::write(const std::filesystem::path& path) const
+{
+    int bins = features.empty() ? 0 : features[0].size();
+    for (const auto& spectrum : features) {
+        if (int(spectrum.size()) != bins) {
+            LOG_ERROR("FeatureCapture: frames differ in size, not writing " << path.string());
+            return false;
+        }
+    }
+
+    CaptureHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+    header.version = CAPTURE_VERSION;
+    header.endianTag = ENDIAN_TAG;
+    header.sampleRate = sampleRate;
+    header.hopSize = hopSize;
+    header.blockSize = blockSize;
+    header.startEvent = startEvent;
+    header.endEvent = endEvent;
+    header.coarseFactor = coarseFactor;
+    header.bandWidth = bandWidth;
+    header.bandRatio = bandRatio;
+    header.firstFrameTime = firstFrameTime;
+    header.bandRescale = bandRescale;
+    header.segmentParallel = segmentParallel;
+    header.scoreNameLength = scoreName.size();
+    header.parameterCount = parameters.size();
+    header.frameCount = features.size();
+    header.binCount = bins;
+
+    std::string buffer(sizeof(header), '\0');
+    header.scoreNameOffset = alignOffset(buffer);
+    buffer += scoreName;
+    header.parametersOffset = alignOffset(buffer);
+    for (const auto& parameter : parameters) {
+        CapturedParameter captured;
+        memset(&captured, 0, sizeof(captured));
+        strncpy(captured.identifier, parameter.first.c_str(), IDENTIFIER_LENGTH - 1);
+        captured.value = parameter.second;
+        buffer.append(reinterpret_cast<const char*>(&captured), sizeof(captured));
+    }
+    header.featuresOffset = alignOffset(buffer);
+    for (const auto& spectrum : features) {
+        buffer.append(reinterpret_cast<const char*>(spectrum.data()), bins * sizeof(float));
+    }
+    memcpy(&buffer[0], &header, sizeof(header));
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out || !out.write(buffer.data(), buffer.size())) {
+        LOG_ERROR("FeatureCapture: unable to write " << path.string());
+        return false;
+    }
+    return true;
+}
+
+bool FeatureCapture::read(const std::filesystem::path& path, FeatureCapture& capture)
+{
+    auto file = MappedFile::open(path);
+    if (!file) {
+        LOG_ERROR("FeatureCapture: cannot open " << path.string());
+        return false;
+    }
+
+    const CaptureHeader* header = file->at<CaptureHeader>(0, 1);
+    if (!header || memcmp(header->magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0 ||
+        header->version != CAPTURE_VERSION || header->endianTag != ENDIAN_TAG) {
+        LOG_ERROR("FeatureCapture: " << path.string() << " is not a compatible capture");
+        return false;
+    }
+    const char* name = file->at<char>(header->scoreNameOffset, header->scoreNameLength);
+    const CapturedParameter* parameters =
+        file->at<CapturedParameter>(header->parametersOffset, header->parameterCount);
+    const float* features = file->at<float>(header->featuresOffset,
+        uint64_t(header->frameCount) * header->binCount);
+    if (!name || !parameters || !features) {
+        LOG_ERROR("FeatureCapture: " << path.string() << " is truncated");
+        return false;
+    }
+
+    capture.scoreName.assign(name, header->scoreNameLength);
+    capture.sampleRate = header->sampleRate;
+    capture.hopSize = header->hopSize;
+    capture.blockSize = header->blockSize;
+    capture.firstFrameTime = header->firstFrameTime;
+    capture.startEvent = header->startEvent;
+    capture.endEvent = header->endEvent;
+    capture.coarseFactor = header->coarseFactor;
+    capture.bandWidth = header->bandWidth;
+    capture.bandRatio = header->bandRatio;
+    capture.bandRescale = header->bandRescale;
+    capture.segmentParallel = header->segmentParallel;
+
+    capture.parameters.clear();
+    for (uint32_t i = 0; i < header->parameterCount; i++) {
+        string identifier(parameters[i].identifier,
+                          strnlen(parameters[i].identifier, IDENTIFIER_LENGTH));
+        capture.parameters.push_back({ identifier, parameters[i].value });
+    }
+
+    capture.features.clear();
+    capture.features.reserve(header->frameCount);
+    for (uint32_t frame = 0; frame < header->frameCount; frame++) {
+        const float* spectrum = features + size_t(frame) * header->binCount;
+        capture.features.emplace_back(spectrum, spectrum + header->binCount);
+    }
+    return true;
+}
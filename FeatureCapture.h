@@ -0,0 +1,55 @@
+/*
+  The exact input to an alignment, as the plugin received it from its
+  host: the spectra passed to AudioToScoreAligner::supplyFeature, the
+  score, and the plugin's parameters and the aligner settings derived
+  from them. Written when the plugin is asked to (see
+  PIANO_ALIGNER_CAPTURE in PianoAligner), so that an alignment seen in
+  a host can be replayed, timed and compared without one (see
+  cli/Replay.cpp).
+*/
+
+#ifndef FEATURE_CAPTURE_H
+#define FEATURE_CAPTURE_H
+
+#include "AudioToScoreAligner.h"
+
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+
+struct FeatureCapture
+{
+    string scoreName;
+    float sampleRate = 0.f;
+    int hopSize = 0;
+    int blockSize = 0;
+    double firstFrameTime = 0.; // of the first frame captured, in seconds
+
+    // The plugin's parameters, by identifier, for reference
+    vector<std::pair<string, float>> parameters;
+
+    // How the aligner was set up, which is what a replay uses
+    int startEvent = 0;
+    int endEvent = 0;
+    int coarseFactor = 1;
+    double bandWidth = -1.;
+    double bandRatio = 0.;
+    bool bandRescale = true;
+    bool segmentParallel = false;
+
+    AudioToScoreAligner::DataFeatures features;
+
+    // Set up an aligner as the captured one was, without its features
+    void configure(AudioToScoreAligner& aligner) const;
+
+    // Returns false, having logged why, on failure
+    bool write(const std::filesystem::path& path) const;
+    static bool read(const std::filesystem::path& path, FeatureCapture& capture);
+};
+
+#endif
@@ -0,0 +1,77 @@
+/*
+  The features the aligner works on, from spectra or from audio.
+*/
+
+#include "FeatureExtractor.h"
+
+#include <cmath>
+
+static const double PI = 3.14159265358979323846;
+
+const int FeatureExtractor::BLOCK_SIZE;
+const int FeatureExtractor::HOP_SIZE;
+
+int FeatureExtractor::getBinCount(int blockSize)
+{
+    int scale = 6; // hard-coded for now
+    return (blockSize / scale) / 2;
+}
+
+AudioToScoreAligner::DataSpectrum
+FeatureExtractor::fromSpectrum(const float* spectrum, int blockSize)
+{
+    int bins = getBinCount(blockSize);
+    AudioToScoreAligner::DataSpectrum s;
+    s.reserve(bins);
+    double total = 0.;
+    for (int i = 1; i <= bins; i++) { // skip DC
+        double real = spectrum[i*2];
+        double imag = spectrum[i*2 + 1];
+        double power = real*real + imag*imag;
+        s.push_back(power);
+        total += power;
+    }
+    for (auto& value: s) {
+        if (total != 0.) {
+            value /= total;
+        }
+    }
+    return s;
+}
+
+FeatureExtractor::FeatureExtractor(int blockSize, int hopSize) :
+    m_blockSize{blockSize}, m_hopSize{hopSize}, m_fft{blockSize}
+{
+    // The Vamp SDK's Hann window
+    for (int i = 0; i < m_blockSize; i++) {
+        m_window.push_back(0.5 - 0.5 * cos(2. * PI * i / m_blockSize));
+    }
+}
+
+AudioToScoreAligner::DataFeatures
+FeatureExtractor::extract(const float* samples, int64_t count) const
+{
+    AudioToScoreAligner::DataFeatures features;
+    int bins = getBinCount(m_blockSize);
+    vector<double> block(m_blockSize);
+    vector<std::complex<double>> transformed(m_blockSize / 2 + 1);
+    vector<float> spectrum(2 * (bins + 1));
+
+    for (int64_t centre = 0; centre < count; centre += m_hopSize) {
+        int64_t start = centre - m_blockSize / 2;
+        for (int i = 0; i < m_blockSize; i++) {
+            int64_t index = start + i;
+            double sample = (index >= 0 && index < count) ? samples[index] : 0.;
+            block[i] = sample * m_window[i];
+        }
+        m_fft.forward(block.data(), transformed.data());
+
+        // Rounded to float, as a host would supply them
+        for (int i = 0; i <= bins; i++) {
+            spectrum[i*2] = float(transformed[i].real());
+            spectrum[i*2 + 1] = float(transformed[i].imag());
+        }
+        features.push_back(fromSpectrum(spectrum.data(), m_blockSize));
+    }
+    return features;
+}
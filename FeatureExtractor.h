@@ -0,0 +1,50 @@
+/*
+  The features the aligner works on: for each frame, the power in the
+  lowest sixth of the spectrum (DC excluded), normalised to sum to 1.
+  PianoAligner computes them from the spectra its host supplies; here
+  they can also be computed from audio directly, windowed and framed
+  as a Vamp host would.
+*/
+
+#ifndef FEATURE_EXTRACTOR_H
+#define FEATURE_EXTRACTOR_H
+
+#include "AudioToScoreAligner.h"
+#include "FFT.h"
+
+#include <cstdint>
+#include <vector>
+
+using std::vector;
+
+
+class FeatureExtractor
+{
+public:
+    // The block and step sizes PianoAligner asks its host for
+    static const int BLOCK_SIZE = 1024 * 6;
+    static const int HOP_SIZE = 128 * 6;
+
+    static int getBinCount(int blockSize);
+
+    // A frame's feature from its spectrum as a Vamp host supplies it:
+    // interleaved real and imaginary parts, starting from DC
+    static AudioToScoreAligner::DataSpectrum fromSpectrum(const float* spectrum,
+                                                          int blockSize);
+
+    FeatureExtractor(int blockSize = BLOCK_SIZE, int hopSize = HOP_SIZE);
+
+    // The features of every frame of some mono audio, with a Hann
+    // window. Frame i is centred on sample i * hopSize, the first half
+    // of the first frame being silence, as Sonic Visualiser does it.
+    // May be called from several threads at once.
+    AudioToScoreAligner::DataFeatures extract(const float* samples, int64_t count) const;
+
+private:
+    int m_blockSize;
+    int m_hopSize;
+    FFT m_fft;
+    vector<double> m_window;
+};
+
+#endif
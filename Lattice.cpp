@@ -0,0 +1,143 @@
+/*
+  Compact storage for the hypotheses of every frame of a pass.
+*/
+
+#include "Lattice.h"
+#include "Log.h"
+
+#include <cmath>
+
+// Below the silent states, -2 and -1, so that the first state in each
+// frame is always coded as a step to a new event
+static const int NO_EVENT = -3;
+
+// Each state is coded as one or two unsigned varints (7 bits to a
+// byte, low bits first). A step within the same event is coded as
+// 2 * (micro index step - 1); a step to a later event as
+// 2 * (event step - 1) + 1, followed by the new micro index. So the
+// two usual steps, to the next micro state or to the first micro
+// state of the next event, take one and two bytes.
+
+static void putVarint(vector<uint8_t>& out, uint32_t value)
+{
+    while (value >= 0x80) {
+        out.push_back(uint8_t(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(uint8_t(value));
+}
+
+static uint32_t getVarint(const uint8_t*& in)
+{
+    uint32_t value = 0;
+    int shift = 0;
+    while (*in & 0x80) {
+        value |= uint32_t(*in++ & 0x7f) << shift;
+        shift += 7;
+    }
+    value |= uint32_t(*in++) << shift;
+    return value;
+}
+
+Lattice::Lattice() :
+    m_lastEvent(NO_EVENT), m_lastMicro(0)
+{
+    m_stateOffsets.push_back(0);
+    m_probOffsets.push_back(0);
+}
+
+void Lattice::addHypothesis(int eventIndex, int microIndex, double prob)
+{
+    if (eventIndex == m_lastEvent) {
+        if (microIndex <= m_lastMicro) {
+            LOG_ERROR("Lattice: state " << eventIndex << "/" << microIndex
+                      << " is out of order");
+            return;
+        }
+        putVarint(m_states, uint32_t(microIndex - m_lastMicro - 1) * 2);
+    } else {
+        if (eventIndex < m_lastEvent) {
+            LOG_ERROR("Lattice: state " << eventIndex << "/" << microIndex
+                      << " is out of order");
+            return;
+        }
+        putVarint(m_states, uint32_t(eventIndex - m_lastEvent - 1) * 2 + 1);
+        putVarint(m_states, uint32_t(microIndex));
+    }
+    m_logProbs.push_back(float(log(prob)));
+    m_lastEvent = eventIndex;
+    m_lastMicro = microIndex;
+}
+
+void Lattice::endFrame()
+{
+    m_stateOffsets.push_back(m_states.size());
+    m_probOffsets.push_back(m_logProbs.size());
+    m_lastEvent = NO_EVENT;
+    m_lastMicro = 0;
+}
+
+void Lattice::finish()
+{
+    m_states.shrink_to_fit();
+    m_logProbs.shrink_to_fit();
+    m_stateOffsets.shrink_to_fit();
+    m_probOffsets.shrink_to_fit();
+}
+
+int Lattice::getFrameCount() const
+{
+    return int(m_probOffsets.size()) - 1;
+}
+
+int Lattice::getHypothesisCount(int frame) const
+{
+    return int(m_probOffsets[frame + 1] - m_probOffsets[frame]);
+}
+
+double Lattice::getProb(int frame, int eventIndex, int microIndex) const
+{
+    for (Reader r(*this, frame); r.next(); ) {
+        if (r.getEventIndex() < eventIndex) continue;
+        if (r.getEventIndex() > eventIndex) break;
+        if (r.getMicroIndex() < microIndex) continue;
+        if (r.getMicroIndex() > microIndex) break;
+        return r.getProb();
+    }
+    return 0.;
+}
+
+size_t Lattice::getBytes() const
+{
+    return m_states.capacity() * sizeof(uint8_t) +
+        m_logProbs.capacity() * sizeof(float) +
+        (m_stateOffsets.capacity() + m_probOffsets.capacity()) * sizeof(size_t);
+}
+
+Lattice::Reader::Reader(const Lattice& lattice, int frame) :
+    m_state(lattice.m_states.data() + lattice.m_stateOffsets[frame]),
+    m_stateEnd(lattice.m_states.data() + lattice.m_stateOffsets[frame + 1]),
+    m_logProb(lattice.m_logProbs.data() + lattice.m_probOffsets[frame]),
+    m_started(false), m_event(NO_EVENT), m_micro(0)
+{
+}
+
+bool Lattice::Reader::next()
+{
+    if (m_state == m_stateEnd) return false;
+    if (m_started) m_logProb++;
+    m_started = true;
+    uint32_t step = getVarint(m_state);
+    if (step & 1) {
+        m_event += int(step >> 1) + 1;
+        m_micro = int(getVarint(m_state));
+    } else {
+        m_micro += int(step >> 1) + 1;
+    }
+    return true;
+}
+
+double Lattice::Reader::getProb() const
+{
+    return exp(double(*m_logProb));
+}
@@ -0,0 +1,80 @@
+/*
+  The hypotheses kept for every frame of a pass over a segment (a
+  forward, backward or posterior lattice), stored compactly enough that
+  those for an hour of audio fit comfortably in memory.
+
+  Each frame's hypotheses are stored in ascending order of state. As
+  the model runs left to right, a beam is nearly contiguous, so each
+  state is coded as a variable-length step from the one before, which
+  is usually a single byte. Probabilities are stored as float logs, as
+  a beam normalised per frame spans too wide a range for a float. The
+  frames are flat arrays indexed by per-frame offsets.
+*/
+
+#ifndef LATTICE_H
+#define LATTICE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using std::vector;
+
+
+class Lattice
+{
+public:
+    Lattice();
+
+    // Append a frame: call addHypothesis() for each of its hypotheses,
+    // in ascending order of (event, micro) state, then endFrame()
+    void addHypothesis(int eventIndex, int microIndex, double prob);
+    void endFrame();
+
+    // Release any memory reserved beyond what the frames added so far
+    // use, once there will be no more
+    void finish();
+
+    int getFrameCount() const;
+    int getHypothesisCount(int frame) const;
+
+    // The probability of a state at a frame, or 0 if it is not in the
+    // frame's beam
+    double getProb(int frame, int eventIndex, int microIndex) const;
+
+    // The memory used, in bytes
+    size_t getBytes() const;
+
+    // Reads a frame's hypotheses in ascending order of state:
+    //   for (Lattice::Reader r(lattice, frame); r.next(); ) ...
+    class Reader
+    {
+    public:
+        Reader(const Lattice& lattice, int frame);
+
+        bool next(); // false once past the last hypothesis
+
+        int getEventIndex() const { return m_event; }
+        int getMicroIndex() const { return m_micro; }
+        float getLogProb() const { return *m_logProb; }
+        double getProb() const;
+
+    private:
+        const uint8_t* m_state;
+        const uint8_t* m_stateEnd;
+        const float* m_logProb;
+        bool m_started;
+        int m_event;
+        int m_micro;
+    };
+
+private:
+    vector<uint8_t> m_states; // coded steps, see addHypothesis
+    vector<float> m_logProbs;
+    vector<size_t> m_stateOffsets; // of each frame, plus the end
+    vector<size_t> m_probOffsets;
+    int m_lastEvent; // of the frame being added
+    int m_lastMicro;
+};
+
+#endif
@@ -0,0 +1,225 @@
+/*
+  Likelihoods of a recording against a score, kept on disk between
+  runs.
+*/
+
+#include "LikelihoodCache.h"
+#include "Log.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+// Bump this whenever the layout below changes. Changes to the
+// templates or to how likelihoods are calculated are in the key
+// instead, see AudioToScoreAligner::openLikelihoodCache.
+static const uint32_t LIKELIHOOD_VERSION = 1;
+
+static const char LIKELIHOOD_MAGIC[8] = { 'P', 'A', 'L', 'I', 'K', 'E', 'L', 'Y' };
+static const uint32_t ENDIAN_TAG = 0x01020304;
+static const char* LIKELIHOOD_EXTENSION = ".likelihoods";
+static const uint64_t DEFAULT_MAX_MEGABYTES = 256;
+
+static const double UNKNOWN = std::numeric_limits<double>::quiet_NaN();
+
+// On-disk layout: the header, a StoredFrame for each frame, and then
+// the values of all the bands one after another, in native byte order
+// (ENDIAN_TAG rejects a file from a machine with the other one) and
+// each section starting on an 8-byte boundary. The values are the
+// likelihoods exactly as calculated, so that reusing them changes
+// nothing.
+
+struct LikelihoodHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t endianTag;
+    uint64_t key[2]; // in full, in case of a clash in the file name
+    uint32_t frameCount;
+    uint32_t reserved;
+    uint64_t framesOffset;
+    uint64_t valuesOffset;
+    uint64_t valueCount;
+};
+
+struct LikelihoodCache::StoredFrame
+{
+    int32_t first; // event
+    int32_t count;
+    uint64_t offset; // of the first value, in values
+    double silence;
+};
+
+LikelihoodCache::LikelihoodCache() :
+    m_files("likelihoods", LIKELIHOOD_EXTENSION, "PIANO_ALIGNER_LIKELIHOOD_CACHE_MB",
+            DEFAULT_MAX_MEGABYTES),
+    m_frames{0}, m_stored{nullptr}, m_values{nullptr}
+{
+}
+
+LikelihoodCache::LikelihoodCache(std::filesystem::path dir, uint64_t maxBytes) :
+    m_files(dir, LIKELIHOOD_EXTENSION, maxBytes),
+    m_frames{0}, m_stored{nullptr}, m_values{nullptr}
+{
+}
+
+LikelihoodCache::~LikelihoodCache()
+{
+}
+
+bool LikelihoodCache::isEnabled() const
+{
+    return m_files.isEnabled();
+}
+
+bool LikelihoodCache::open(const CacheKey& key, int frames)
+{
+    m_key = key;
+    m_frames = frames;
+    m_file = nullptr;
+    m_stored = nullptr;
+    m_values = nullptr;
+    if (!m_files.isEnabled()) return false;
+
+    std::filesystem::path p = m_files.getPath(key);
+    auto file = MappedFile::open(p);
+    if (!file) return false;
+
+    const LikelihoodHeader* header = file->at<LikelihoodHeader>(0, 1);
+    if (!header || memcmp(header->magic, LIKELIHOOD_MAGIC, sizeof(LIKELIHOOD_MAGIC)) != 0 ||
+        header->version != LIKELIHOOD_VERSION || header->endianTag != ENDIAN_TAG ||
+        header->key[0] != key.getHash(0) || header->key[1] != key.getHash(1) ||
+        int(header->frameCount) != frames) {
+        LOG_WARNING("LikelihoodCache: ignoring incompatible likelihoods " << p);
+        return false;
+    }
+    const StoredFrame* stored = file->at<StoredFrame>(header->framesOffset, frames);
+    const double* values = file->at<double>(header->valuesOffset, header->valueCount);
+    if (!stored || !values) {
+        LOG_WARNING("LikelihoodCache: likelihoods " << p << " are truncated");
+        return false;
+    }
+    for (int frame = 0; frame < frames; frame++) {
+        if (stored[frame].count < 0 ||
+            stored[frame].offset + stored[frame].count > header->valueCount) {
+            LOG_WARNING("LikelihoodCache: likelihoods " << p << " are corrupt");
+            return false;
+        }
+    }
+
+    m_file = file;
+    m_stored = stored;
+    m_values = values;
+    m_files.touch(key);
+    LOG_DEBUG("LikelihoodCache: mapped " << header->valueCount << " stored likelihood(s) from "
+              << p);
+    return true;
+}
+
+int LikelihoodCache::getFrameCount() const
+{
+    return m_frames;
+}
+
+bool LikelihoodCache::find(int frame, int event, double& likelihood) const
+{
+    if (!m_stored || frame < 0 || frame >= m_frames) return false;
+    const StoredFrame& stored = m_stored[frame];
+    int index = event - stored.first;
+    if (index < 0 || index >= stored.count) return false;
+    double value = m_values[stored.offset + index];
+    if (std::isnan(value)) return false;
+    likelihood = value;
+    return true;
+}
+
+bool LikelihoodCache::findSilence(int frame, double& likelihood) const
+{
+    if (!m_stored || frame < 0 || frame >= m_frames) return false;
+    double value = m_stored[frame].silence;
+    if (std::isnan(value)) return false;
+    likelihood = value;
+    return true;
+}
+
+static void alignOffset(string& buffer)
+{
+    buffer.resize((buffer.size() + 7) / 8 * 8, '\0');
+}
+
+bool LikelihoodCache::store(const vector<Band>& bands)
+{
+    if (!m_files.isEnabled()) return false;
+    if (int(bands.size()) != m_frames) {
+        LOG_WARNING("LikelihoodCache: expected " << m_frames << " frame(s), not "
+                    << bands.size() << ", so not storing likelihoods");
+        return false;
+    }
+
+    // Each frame's band widens to take in both what was stored and what
+    // is new, preferring the new where both have a value
+    vector<StoredFrame> frames(m_frames);
+    vector<double> values;
+    for (int frame = 0; frame < m_frames; frame++) {
+        const Band& band = bands[frame];
+        int first = band.first, end = band.first + int(band.values.size());
+        double silence = band.silence;
+        if (m_stored) {
+            const StoredFrame& stored = m_stored[frame];
+            if (stored.count > 0) {
+                if (band.values.empty()) {
+                    first = stored.first;
+                    end = stored.first + stored.count;
+                } else {
+                    first = std::min(first, int(stored.first));
+                    end = std::max(end, int(stored.first + stored.count));
+                }
+            }
+            if (std::isnan(silence)) silence = stored.silence;
+        }
+        frames[frame].first = first;
+        frames[frame].count = end - first;
+        frames[frame].offset = values.size();
+        frames[frame].silence = silence;
+        values.resize(values.size() + (end - first), UNKNOWN);
+        double* row = values.data() + frames[frame].offset;
+        if (m_stored) {
+            const StoredFrame& stored = m_stored[frame];
+            for (int i = 0; i < stored.count; i++) {
+                row[stored.first + i - first] = m_values[stored.offset + i];
+            }
+        }
+        for (int i = 0; i < int(band.values.size()); i++) {
+            if (!std::isnan(band.values[i])) row[band.first + i - first] = band.values[i];
+        }
+    }
+
+    LikelihoodHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LIKELIHOOD_MAGIC, sizeof(LIKELIHOOD_MAGIC));
+    header.version = LIKELIHOOD_VERSION;
+    header.endianTag = ENDIAN_TAG;
+    header.key[0] = m_key.getHash(0);
+    header.key[1] = m_key.getHash(1);
+    header.frameCount = m_frames;
+    header.valueCount = values.size();
+
+    string contents(sizeof(header), '\0');
+    alignOffset(contents);
+    header.framesOffset = contents.size();
+    contents.append(reinterpret_cast<const char*>(frames.data()),
+                    frames.size() * sizeof(StoredFrame));
+    alignOffset(contents);
+    header.valuesOffset = contents.size();
+    contents.append(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(double));
+    memcpy(&contents[0], &header, sizeof(header));
+
+    if (!m_files.write(m_key, contents)) return false;
+    LOG_DEBUG("LikelihoodCache: stored " << values.size() << " likelihood(s)");
+
+    // Map what was just written, so that another store adds to it
+    open(m_key, m_frames);
+    return true;
+}
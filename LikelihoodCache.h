@@ -0,0 +1,80 @@
+/*
+  Likelihoods of a recording's frames against a score's events, kept
+  on disk between runs in a memory-mapped file, so that a run with
+  other settings that leave the likelihoods alone (the event range,
+  corridor, beam or decoding mode) calculates only the cells no
+  earlier run did. Each frame keeps the band of events calculated for
+  it, and the likelihood of silence.
+*/
+
+#ifndef LIKELIHOOD_CACHE_H
+#define LIKELIHOOD_CACHE_H
+
+#include "CacheKey.h"
+#include "DiskCache.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+using std::vector;
+
+class MappedFile;
+
+
+class LikelihoodCache
+{
+public:
+    // The likelihoods of one frame: of events first onwards, with NaN
+    // for those not calculated, and of silence (NaN if not calculated)
+    struct Band
+    {
+        int first;
+        vector<double> values;
+        double silence;
+    };
+
+    // The cache in the "likelihoods" folder of
+    // Paths::getCacheDirectory(), bounded to
+    // PIANO_ALIGNER_LIKELIHOOD_CACHE_MB megabytes (256 if unset).
+    // Disabled if that is 0, or if there is no cache directory.
+    LikelihoodCache();
+
+    LikelihoodCache(std::filesystem::path dir, uint64_t maxBytes);
+
+    ~LikelihoodCache();
+
+    bool isEnabled() const;
+
+    // Map the likelihoods stored under key for a recording of this many
+    // frames, if there are any. Returns true if there were.
+    bool open(const CacheKey& key, int frames);
+
+    int getFrameCount() const;
+
+    // A stored likelihood, if there is one. These may be called from
+    // several threads at once.
+    bool find(int frame, int event, double& likelihood) const;
+    bool findSilence(int frame, double& likelihood) const;
+
+    // Store these likelihoods, one band per frame, under the key last
+    // opened, along with those already stored. Returns false if they
+    // could not be written, which is not otherwise an error.
+    bool store(const vector<Band>& bands);
+
+private:
+    LikelihoodCache(const LikelihoodCache&) = delete;
+    LikelihoodCache& operator=(const LikelihoodCache&) = delete;
+
+    struct StoredFrame;
+
+    DiskCache m_files;
+    CacheKey m_key;
+    int m_frames;
+    std::shared_ptr<MappedFile> m_file; // null if nothing is stored
+    const StoredFrame* m_stored;
+    const double* m_values;
+};
+
+#endif
@@ -0,0 +1,39 @@
+/*
+  Leveled diagnostic logging to stderr.
+*/
+
+#include "Log.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+
+static int readLevel()
+{
+    const char* names[] = { "error", "warning", "info", "debug", "trace" };
+    const char* value = getenv("PIANO_ALIGNER_LOG");
+    if (!value || !*value) return PIANO_ALIGNER_LOG_INFO;
+    for (int level = 0; level <= PIANO_ALIGNER_LOG_TRACE; level++) {
+        if (!strcmp(value, names[level])) return level;
+    }
+    char* end = nullptr;
+    long level = strtol(value, &end, 10);
+    if (*end == '\0') return level;
+    std::cerr << "Log: unknown PIANO_ALIGNER_LOG level \"" << value
+              << "\", using info" << std::endl;
+    return PIANO_ALIGNER_LOG_INFO;
+}
+
+int Log::getLevel()
+{
+    static const int level = readLevel();
+    return level;
+}
+
+void Log::write(const std::string& message)
+{
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> guard(mutex);
+    std::cerr << message << '\n';
+}
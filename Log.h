@@ -0,0 +1,56 @@
+/*
+  Leveled diagnostic logging to stderr.
+
+  Statements are written as e.g.
+
+    LOG_DEBUG("event " << event << " starts at frame " << frame);
+
+  and are compiled out entirely above PIANO_ALIGNER_LOG_LEVEL (by
+  default everything but trace). The rest are written only at or below
+  the level given at run time by the PIANO_ALIGNER_LOG environment
+  variable (error, warning, info, debug or trace, or 0 to 4; default
+  info). A disabled statement evaluates none of its arguments.
+*/
+
+#ifndef PIANO_ALIGNER_LOG_H
+#define PIANO_ALIGNER_LOG_H
+
+#include <sstream>
+
+#define PIANO_ALIGNER_LOG_ERROR 0
+#define PIANO_ALIGNER_LOG_WARNING 1
+#define PIANO_ALIGNER_LOG_INFO 2
+#define PIANO_ALIGNER_LOG_DEBUG 3
+#define PIANO_ALIGNER_LOG_TRACE 4 // e.g. per frame or per hypothesis
+
+#ifndef PIANO_ALIGNER_LOG_LEVEL
+#define PIANO_ALIGNER_LOG_LEVEL PIANO_ALIGNER_LOG_DEBUG
+#endif
+
+class Log
+{
+public:
+    // The level set at run time, read from the environment once
+    static int getLevel();
+
+    // Write one message, as a whole line, so that messages from
+    // different threads are not interleaved
+    static void write(const std::string& message);
+};
+
+#define PIANO_ALIGNER_LOG(level, expr) \
+    do { \
+        if ((level) <= PIANO_ALIGNER_LOG_LEVEL && (level) <= Log::getLevel()) { \
+            std::ostringstream log_stream_; \
+            log_stream_ << expr; \
+            Log::write(log_stream_.str()); \
+        } \
+    } while (0)
+
+#define LOG_ERROR(expr) PIANO_ALIGNER_LOG(PIANO_ALIGNER_LOG_ERROR, expr)
+#define LOG_WARNING(expr) PIANO_ALIGNER_LOG(PIANO_ALIGNER_LOG_WARNING, expr)
+#define LOG_INFO(expr) PIANO_ALIGNER_LOG(PIANO_ALIGNER_LOG_INFO, expr)
+#define LOG_DEBUG(expr) PIANO_ALIGNER_LOG(PIANO_ALIGNER_LOG_DEBUG, expr)
+#define LOG_TRACE(expr) PIANO_ALIGNER_LOG(PIANO_ALIGNER_LOG_TRACE, expr)
+
+#endif
@@ -0,0 +1,69 @@
+/*
+  A read-only view of a whole file, memory-mapped where the platform
+  allows and read into memory otherwise.
+*/
+
+#include "MappedFile.h"
+
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+MappedFile::MappedFile() :
+    m_data{nullptr}, m_size{0}
+{
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+    delete[] m_data;
+#else
+    if (m_data) munmap(const_cast<char*>(m_data), m_size);
+#endif
+}
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::filesystem::path& path)
+{
+    std::shared_ptr<MappedFile> file(new MappedFile());
+#ifdef _WIN32
+    // No mmap here; reading it all in is still far quicker than
+    // reading it line by line
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) return nullptr;
+    size_t size = in.tellg();
+    if (size == 0) return file;
+    char* data = new char[size];
+    in.seekg(0);
+    if (!in.read(data, size)) {
+        delete[] data;
+        return nullptr;
+    }
+    file->m_data = data;
+    file->m_size = size;
+#else
+    int fd = ::open(path.string().c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return nullptr;
+    }
+    if (st.st_size == 0) {
+        ::close(fd);
+        return file;
+    }
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) return nullptr;
+    file->m_data = static_cast<const char*>(data);
+    file->m_size = st.st_size;
+#endif
+    return file;
+}
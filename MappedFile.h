@@ -0,0 +1,47 @@
+/*
+  A read-only view of a whole file, memory-mapped where the platform
+  allows and read into memory otherwise.
+*/
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+
+
+class MappedFile
+{
+public:
+    ~MappedFile();
+
+    // Returns nullptr if the file cannot be opened. An empty file gives
+    // a MappedFile with no data.
+    static std::shared_ptr<MappedFile> open(const std::filesystem::path& path);
+
+    const char* getData() const { return m_data; }
+    size_t getSize() const { return m_size; }
+
+    // Pointer to count values of type T at the given offset, or nullptr
+    // if they would be misaligned or run off the end of the file
+    template <typename T>
+    const T* at(uint64_t offset, uint64_t count) const {
+        if (offset % alignof(T) != 0 || offset > m_size ||
+            count > (m_size - offset) / sizeof(T)) {
+            return nullptr;
+        }
+        return reinterpret_cast<const T*>(m_data + offset);
+    }
+
+private:
+    MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* m_data;
+    size_t m_size;
+};
+
+#endif
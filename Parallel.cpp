@@ -0,0 +1,62 @@
+/*
+  Simple fork-join helper for the few places where independent pieces
+  of work can be spread over the available cores.
+*/
+
+#include "Parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+namespace {
+
+// Shared with the helpers, which may outlive the call if they only
+// start once the caller has done all the work itself
+struct Group {
+    Group(int count_, std::function<void(int)> task_) :
+        count(count_), task(std::move(task_)), next(0), finished(0) { }
+
+    const int count;
+    const std::function<void(int)> task;
+    std::atomic<int> next;
+    int finished;
+    std::mutex mutex;
+    std::condition_variable done;
+
+    void work() {
+        int i, n = 0;
+        while ((i = next++) < count) {
+            task(i);
+            n++;
+        }
+        if (n == 0) return;
+        std::lock_guard<std::mutex> guard(mutex);
+        finished += n;
+        if (finished == count) done.notify_all();
+    }
+};
+
+}
+
+void runInParallel(int count, std::function<void(int)> task, ThreadPool::Priority priority)
+{
+    ThreadPool& pool = ThreadPool::getShared();
+    int helpers = std::min(pool.getThreadCount(), count) - 1;
+    if (helpers <= 0) {
+        for (int i = 0; i < count; i++) task(i);
+        return;
+    }
+
+    // The caller works too, so never waits on a helper that has not
+    // started, which could otherwise deadlock if it is itself a worker
+    auto group = std::make_shared<Group>(count, std::move(task));
+    for (int h = 0; h < helpers; h++) {
+        pool.submit([group]() { group->work(); }, priority);
+    }
+    group->work();
+    std::unique_lock<std::mutex> lock(group->mutex);
+    group->done.wait(lock, [&]() { return group->finished == count; });
+}
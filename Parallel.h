@@ -0,0 +1,20 @@
+/*
+  Simple fork-join helper for the few places where independent pieces
+  of work can be spread over the available cores, using the pool
+  shared by the whole process (see ThreadPool).
+*/
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "ThreadPool.h"
+
+#include <functional>
+
+// Run task(0) to task(count - 1) on as many threads as are useful,
+// including the calling one, returning when all have finished. May be
+// called from a task already running in the pool.
+void runInParallel(int count, std::function<void(int)> task,
+                   ThreadPool::Priority priority = ThreadPool::Normal);
+
+#endif
@@ -1,15 +1,13 @@
 
 #include "Paths.h"
+#include "ScoreLibrary.h"
 
-#include <iostream>
+#include <cstdlib>
 
 using std::vector;
 using std::filesystem::path;
-using std::filesystem::directory_iterator;
 using std::string;
 using std::map;
-using std::cerr;
-using std::endl;
 
 static vector<path> splitPath(string str)
 {
@@ -50,55 +48,23 @@ Paths::getScoreDirectories()
 map<string, path>
 Paths::getScores()
 {
-    auto dirs = getScoreDirectories();
-    int dirsThatExist = 0;
-    map<string, path> scores;
-
-    for (auto dir : dirs) {
-
-        if (!exists(dir)) continue;
-        ++dirsThatExist;
-
-        for (auto entry : directory_iterator(dir)) {
-
-            path candidate = entry.path();
-            string name(candidate.filename().string());
-            if (name.size() == 0 || name[0] == '.' ||
-                scores.find(name) != scores.end()) {
-                continue;
-            }
-
-            path scoreFile(candidate.string() + "/" + name + ".solo");
-            if (!exists(scoreFile)) {
-                cerr << "WARNING: Candidate score folder "
-                     << candidate << " lacks " << name << ".solo file"
-                     << endl;
-                continue;
-            }
-
-            path tempoFile(candidate.string() + "/" + name + ".tempo");
-            if (!exists(tempoFile)) {
-                cerr << "WARNING: Candidate score folder "
-                     << candidate << " lacks " << name << ".tempo file"
-                     << endl;
-                continue;
-            }
-
-            cerr << "Found valid-looking score folder: " << candidate << endl;
-            scores[name] = candidate;
-        }
-    }
+    return ScoreLibrary::getScores();
+}
 
-    if (dirsThatExist == 0) {
-        cerr << "WARNING: None of the specified score folders exists!" << endl;
-        cerr << "Folders are:" << endl;
-        for (auto dir : dirs) {
-            cerr << dir << endl;
-        }
+path
+Paths::getCacheDirectory()
+{
+#ifdef _WIN32
+    auto base = getenv("LOCALAPPDATA");
+    if (!base) return {};
+    return path(string(base)) / "PianoAligner";
+#else
+    auto xdg = getenv("XDG_CACHE_HOME");
+    if (xdg && *xdg) {
+        return path(string(xdg)) / "piano-aligner";
     }
-    
-    return scores;
+    auto home = getenv("HOME");
+    if (!home) return {};
+    return path(string(home)) / ".cache" / "piano-aligner";
+#endif
 }
-
-
-
@@ -36,8 +36,20 @@ public:
      *
      * If more than one of the score directories contains a score with
      * a given name, the first one found takes priority.
+     *
+     * The scores come from the process-wide ScoreLibrary index rather
+     * than a fresh search of the directories.
      */
     static std::map<std::string, std::filesystem::path> getScores();
+
+    /**
+     * Return the directory for files cached between runs, such as the
+     * score library index: a "piano-aligner" folder in the user's
+     * cache directory (%LOCALAPPDATA%\PianoAligner on Windows). Return
+     * an empty path if there is nowhere suitable. Note that this
+     * function does not create the directory.
+     */
+    static std::filesystem::path getCacheDirectory();
 };
 
 #endif
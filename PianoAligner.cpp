@@ -4,12 +4,20 @@
 
 #include "PianoAligner.h"
 #include "AudioToScoreAligner.h"
+#include "FeatureCapture.h"
+#include "FeatureExtractor.h"
+#include "Log.h"
 
 #include "Templates.h"
 #include "Paths.h"
+#include "ScoreCache.h"
 #include "Score.h" // delete later
+#include <chrono>
 #include <cmath> // delete later
+#include <cstdlib>
 #include <filesystem>
+#include <set>
+#include <sstream>
 
 
 PianoAligner::PianoAligner(float inputSampleRate) :
@@ -20,6 +28,15 @@ PianoAligner::PianoAligner(float inputSampleRate) :
     m_scorePositionEnd(-1.f),
     m_audioStart_sec(-1.f),
     m_audioEnd_sec(-1.f),
+    m_segmentParallel(false),
+    m_coarseFactor(1),
+    m_bandWidth(-1.f),
+    m_bandTempoRatio(0.f),
+    m_bandRescale(true),
+    m_spectrumDecimation(1),
+    m_eventTempoOutput(true),
+    m_threadPriority(ThreadPool::Normal),
+    m_persistLikelihoods(false),
     m_isFirstFrame(true),
     m_frameCount(0)
 {
@@ -128,7 +145,7 @@ PianoAligner::getParameterDescriptors() const
 
     d.identifier = "score-position-start";
     d.name = "Score Position - Start";
-    d.description = "";
+    d.description = "First score position to align, in measures (e.g. 12.5 is halfway through measure 12), or -1 for the start of the score";
     d.unit = "";
     d.minValue = -1.f;
     d.maxValue = 100000.f;
@@ -138,7 +155,7 @@ PianoAligner::getParameterDescriptors() const
 
     d.identifier = "score-position-end";
     d.name = "Score Position - End";
-    d.description = "";
+    d.description = "Last score position to align, in measures, or -1 for the end of the score";
     d.unit = "";
     d.minValue = -1.f;
     d.maxValue = 100000.f;
@@ -148,7 +165,7 @@ PianoAligner::getParameterDescriptors() const
 
     d.identifier = "audio-start";
     d.name = "Audio - Start";
-    d.description = "";
+    d.description = "Time of the first audio frame to align, or -1 for the start of the audio";
     d.unit = "s";
     d.minValue = -1.f;
     d.maxValue = 3600.f;
@@ -158,7 +175,7 @@ PianoAligner::getParameterDescriptors() const
 
     d.identifier = "audio-end";
     d.name = "Audio - End";
-    d.description = "";
+    d.description = "Time of the last audio frame to align, or -1 for the end of the audio";
     d.unit = "s";
     d.minValue = -1.f;
     d.maxValue = 3600.f;
@@ -166,6 +183,105 @@ PianoAligner::getParameterDescriptors() const
     d.isQuantized = false;
     list.push_back(d);
 
+    d.identifier = "segment-parallel";
+    d.name = "Segment-Parallel Alignment";
+    d.description = "Find confident points with a quick first pass, then align the segments between them in parallel";
+    d.unit = "";
+    d.minValue = 0.f;
+    d.maxValue = 1.f;
+    d.defaultValue = 0.f;
+    d.isQuantized = true;
+    d.quantizeStep = 1.f;
+    list.push_back(d);
+
+    d.identifier = "coarse-factor";
+    d.name = "Coarse-to-Fine Pooling Factor";
+    d.description = "Align first with this many frames pooled together, then at full resolution only near the coarse alignment. 1 aligns at full resolution throughout";
+    d.unit = "";
+    d.minValue = 1.f;
+    d.maxValue = 16.f;
+    d.defaultValue = 1.f;
+    d.isQuantized = true;
+    d.quantizeStep = 1.f;
+    list.push_back(d);
+
+    d.identifier = "band-width";
+    d.name = "Tempo Band Width";
+    d.description = "Only allow each event within this many seconds of its nominal time from the score tempo, or -1 for no band";
+    d.unit = "s";
+    d.minValue = -1.f;
+    d.maxValue = 600.f;
+    d.defaultValue = -1.f;
+    d.isQuantized = false;
+    list.push_back(d);
+
+    d.identifier = "band-tempo-ratio";
+    d.name = "Tempo Band Deviation";
+    d.description = "Widen the tempo band further by this proportion of the elapsed time, to allow for the performance tempo deviating from the score";
+    d.unit = "";
+    d.minValue = 0.f;
+    d.maxValue = 4.f;
+    d.defaultValue = 0.f;
+    d.isQuantized = false;
+    list.push_back(d);
+
+    d.identifier = "band-rescale";
+    d.name = "Tempo Band Rescale";
+    d.description = "Stretch the nominal score timeline to the length of the audio before applying the tempo band";
+    d.unit = "";
+    d.minValue = 0.f;
+    d.maxValue = 1.f;
+    d.defaultValue = 1.f;
+    d.isQuantized = true;
+    d.quantizeStep = 1.f;
+    list.push_back(d);
+
+    d.identifier = "spectrum-decimation";
+    d.name = "Power Spectrum Output Decimation";
+    d.description = "Render the Testing Power Spectrum output for every Nth frame only, or not at all if 0";
+    d.unit = "";
+    d.minValue = 0.f;
+    d.maxValue = 64.f;
+    d.defaultValue = 1.f;
+    d.isQuantized = true;
+    d.quantizeStep = 1.f;
+    list.push_back(d);
+
+    d.identifier = "event-tempo-output";
+    d.name = "Event Tempo Output";
+    d.description = "Calculate the Event Tempo output";
+    d.unit = "";
+    d.minValue = 0.f;
+    d.maxValue = 1.f;
+    d.defaultValue = 1.f;
+    d.isQuantized = true;
+    d.quantizeStep = 1.f;
+    list.push_back(d);
+
+    d.identifier = "thread-priority";
+    d.name = "Thread Priority";
+    d.description = "Priority of this instance's parallel work relative to that of other instances in the same process, which all share one pool of threads";
+    d.unit = "";
+    d.minValue = 0.f;
+    d.maxValue = 2.f;
+    d.defaultValue = 1.f;
+    d.isQuantized = true;
+    d.quantizeStep = 1.f;
+    d.valueNames = { "Low", "Normal", "High" };
+    list.push_back(d);
+    d.valueNames.clear();
+
+    d.identifier = "persist-likelihoods";
+    d.name = "Persist Likelihoods";
+    d.description = "Keep the likelihoods calculated on disk, and reuse those kept before for the same score and audio";
+    d.unit = "";
+    d.minValue = 0.f;
+    d.maxValue = 1.f;
+    d.defaultValue = 0.f;
+    d.isQuantized = true;
+    d.quantizeStep = 1.f;
+    list.push_back(d);
+
     return list;
 }
 
@@ -180,6 +296,24 @@ PianoAligner::getParameter(string identifier) const
         return m_audioStart_sec;
     } else if (identifier == "audio-end") {
         return m_audioEnd_sec;
+    } else if (identifier == "segment-parallel") {
+        return m_segmentParallel ? 1.f : 0.f;
+    } else if (identifier == "coarse-factor") {
+        return m_coarseFactor;
+    } else if (identifier == "band-width") {
+        return m_bandWidth;
+    } else if (identifier == "band-tempo-ratio") {
+        return m_bandTempoRatio;
+    } else if (identifier == "band-rescale") {
+        return m_bandRescale ? 1.f : 0.f;
+    } else if (identifier == "spectrum-decimation") {
+        return m_spectrumDecimation;
+    } else if (identifier == "event-tempo-output") {
+        return m_eventTempoOutput ? 1.f : 0.f;
+    } else if (identifier == "thread-priority") {
+        return m_threadPriority;
+    } else if (identifier == "persist-likelihoods") {
+        return m_persistLikelihoods ? 1.f : 0.f;
     }
     return 0;
 }
@@ -195,6 +329,25 @@ PianoAligner::setParameter(string identifier, float value)
         m_audioStart_sec = value;
     } else if (identifier == "audio-end") {
         m_audioEnd_sec = value;
+    } else if (identifier == "segment-parallel") {
+        m_segmentParallel = (value > 0.5f);
+    } else if (identifier == "coarse-factor") {
+        m_coarseFactor = int(round(value));
+    } else if (identifier == "band-width") {
+        m_bandWidth = value;
+    } else if (identifier == "band-tempo-ratio") {
+        m_bandTempoRatio = value;
+    } else if (identifier == "band-rescale") {
+        m_bandRescale = (value > 0.5f);
+    } else if (identifier == "spectrum-decimation") {
+        m_spectrumDecimation = std::max(0, int(round(value)));
+    } else if (identifier == "event-tempo-output") {
+        m_eventTempoOutput = (value > 0.5f);
+    } else if (identifier == "thread-priority") {
+        m_threadPriority = ThreadPool::Priority(std::min(std::max(int(round(value)), 0),
+                                                         ThreadPool::PriorityCount - 1));
+    } else if (identifier == "persist-likelihoods") {
+        m_persistLikelihoods = (value > 0.5f);
     }
 }
 
@@ -205,10 +358,9 @@ PianoAligner::getPrograms() const
 
     auto scores = Paths::getScores();
 
-    std::cerr << "PianoAligner::getPrograms: have " << scores.size() << " scores" << std::endl;
+    LOG_DEBUG("PianoAligner::getPrograms: have " << scores.size() << " scores");
 
     for (auto score : scores) {
-        std::cerr << "PianoAligner::getPrograms: score " << score.first << std::endl;
         list.push_back(score.first);
     }
 
@@ -228,7 +380,7 @@ void
 PianoAligner::selectProgram(string name)
 {
     m_scoreName = name;
-    std::cerr << "In selectProgram: name is -> " << name << '\n'; // ???
+    LOG_DEBUG("In selectProgram: name is -> " << name);
 }
 
 PianoAligner::OutputList
@@ -297,7 +449,7 @@ PianoAligner::getOutputDescriptors() const
     d.hasKnownExtents = false;
     d.isQuantized = false;
     d.sampleType = OutputDescriptor::FixedSampleRate;
-    d.sampleRate = m_inputSampleRate/(128*6);
+    d.sampleRate = m_inputSampleRate/(128*6*std::max(1, m_spectrumDecimation));
     list.push_back(d);
 
     // Onsets:
@@ -326,6 +478,19 @@ PianoAligner::getOutputDescriptors() const
     d.hasDuration = false;
     list.push_back(d);
 
+    // Timings and counters from the alignment, one feature per
+    // statistic, labelled with its name:
+    d.identifier = "alignmentstats";
+    d.name = "Alignment Statistics";
+    d.description = "Time spent in each stage of the alignment, and counts of the work done";
+    d.unit = "";
+    d.hasFixedBinCount = true;
+    d.binCount = 1;
+    d.hasKnownExtents = false;
+    d.isQuantized = false;
+    d.sampleType = OutputDescriptor::VariableSampleRate;
+    d.hasDuration = false;
+    list.push_back(d);
 
     return list;
 }
@@ -345,10 +510,10 @@ PianoAligner::initialise(size_t channels, size_t stepSize, size_t blockSize)
 
     m_isFirstFrame = true;
 
-    std::cerr << "PianoAligner::initialise: score position start = "
-              << m_scorePositionStart << ", end = " << m_scorePositionEnd
-              << ", audio start = " << m_audioStart_sec << ", end = "
-              << m_audioEnd_sec << std::endl;
+    LOG_INFO("PianoAligner::initialise: score position start = "
+             << m_scorePositionStart << ", end = " << m_scorePositionEnd
+             << ", audio start = " << m_audioStart_sec << ", end = "
+             << m_audioEnd_sec);
     
     // Real initialisation work goes here!
 
@@ -364,24 +529,48 @@ PianoAligner::initialise(size_t channels, size_t stepSize, size_t blockSize)
         if (getenv("PIANO_ALIGNER_USE_DEFAULT_SCORE") != nullptr) {
             auto programs = getPrograms();
             if (programs.empty()) {
-                std::cerr << "PianoAligner::initialise: No scores available" << std::endl;
+                LOG_ERROR("PianoAligner::initialise: No scores available");
                 return false;
             } else {
                 m_scoreName = programs[0];
             }
         } else {
-            std::cerr << "PianoAligner::initialise: No score selected" << std::endl;
+            LOG_ERROR("PianoAligner::initialise: No score selected");
             return false;
         }
     }
     
-    if (m_aligner->loadAScore(m_scoreName, blockSize)) {
-	    return true;
-    } else {
-        std::cerr << "PianoAligner::initialise: Failed to load score "
-		  << m_scoreName << std::endl;
+    if (!m_aligner->loadAScore(m_scoreName, blockSize)) {
+        LOG_ERROR("PianoAligner::initialise: Failed to load score "
+		  << m_scoreName);
 	    return false;
     }
+
+    // Only the events within the score position constraints are
+    // built into the HMM
+    const Score& score = m_aligner->getScore();
+    int startEvent = 0;
+    int endEvent = score.getMusicalEvents().size();
+    if (m_scorePositionStart >= 0) {
+        startEvent = score.getEventIndexForPosition(m_scorePositionStart, true);
+    }
+    if (m_scorePositionEnd >= 0) {
+        endEvent = score.getEventIndexForPosition(m_scorePositionEnd, false);
+    }
+    if (startEvent >= endEvent) {
+        LOG_ERROR("PianoAligner::initialise: No events in score position range "
+                  << m_scorePositionStart << " to " << m_scorePositionEnd);
+        return false;
+    }
+    m_aligner->setEventRange(startEvent, endEvent);
+    m_aligner->setCoarseFactor(m_coarseFactor);
+    m_aligner->setTempoBand(m_bandWidth, m_bandTempoRatio, m_bandRescale);
+    m_aligner->setPriority(m_threadPriority);
+    m_aligner->setPersistentLikelihoods(m_persistLikelihoods);
+    LOG_INFO("PianoAligner::initialise: aligning events " << startEvent
+             << " to " << endEvent - 1);
+
+    return true;
 }
 
 void
@@ -396,32 +585,28 @@ PianoAligner::process(const float *const *inputBuffers, Vamp::RealTime timestamp
 {
     // Do actual work!
 
+    // Frames outside the audio constraints are neither stored nor
+    // scored. The aligned frames are numbered from the first one
+    // stored, so m_firstFrameTime maps them back to absolute time.
+    if (m_audioStart_sec >= 0 &&
+        timestamp < Vamp::RealTime::fromSeconds(m_audioStart_sec)) {
+        return FeatureSet();
+    }
+    if (m_audioEnd_sec >= 0 &&
+        timestamp > Vamp::RealTime::fromSeconds(m_audioEnd_sec)) {
+        return FeatureSet();
+    }
+
     if (m_isFirstFrame) {
         m_firstFrameTime = timestamp; // 0.064000000R in simple-host; 0.000000000R in SV
         m_isFirstFrame = false;
         m_frameCount = 0;
-        std::cerr << "first frame time = "<<timestamp << '\n';
+        LOG_DEBUG("first frame time = "<<timestamp);
     }
 
-    int scale = 6; // hard-coded for now
-    int bins = (m_blockSize/scale)/2;
-    const float *fbuf = inputBuffers[0];
-    AudioToScoreAligner::DataSpectrum s;
-    s.reserve(bins);
-    double total = 0.;
-    for (int i = 1; i <= bins; i++) { // skip DC
-        double real = fbuf[i*2];
-        double imag = fbuf[i*2 + 1];
-        double power = real*real + imag*imag;
-        s.push_back(power);
-        total += power;
-    }
-    for (auto& value: s) {
-        if (total != 0.) {
-            value /= total;
-        }
-    }
-    m_aligner->supplyFeature(s);
+    AlignmentStats::Timer timer(m_aligner->getStats(), AlignmentStats::FeatureIngestion);
+
+    m_aligner->supplyFeature(FeatureExtractor::fromSpectrum(inputBuffers[0], m_blockSize));
 
 
 /*
@@ -474,50 +659,51 @@ PianoAligner::getRemainingFeatures()
 */
 
 
+    // Record the input first, so that it is kept even if the alignment
+    // fails. Parameters can only be numbers, so the path comes from the
+    // environment.
+    const char* capturePath = getenv("PIANO_ALIGNER_CAPTURE");
+    if (capturePath && *capturePath) {
+        writeCapture(capturePath);
+    }
+
+    // A repeat of an alignment already done comes from the result
+    // cache instead
+    auto start = std::chrono::steady_clock::now();
+    ResultCache cache;
+    CacheKey key;
+    vector<ResultCache::Onset> onsets;
+    AudioToScoreAligner::AlignmentResults alignmentResults;
+    if (cache.isEnabled()) {
+        key = getResultKey();
+        int events = m_aligner->getEndEvent() - m_aligner->getStartEvent();
+        if (cache.find(key, onsets) && int(onsets.size()) == events) {
+            for (const auto& onset : onsets) alignmentResults.push_back(onset.frame);
+            LOG_INFO("PianoAligner: alignment of " << m_scoreName
+                     << " found in the result cache");
+        }
+    }
+
     // Window version:
-    vector<int> frames;
-    AudioToScoreAligner::AlignmentResults alignmentResults = m_aligner->align();
-    Score::MusicalEventList eventList = m_aligner->getScore().getMusicalEvents();
-    int event = 0;
-    int lastChange = 0; // last event index that defines a new tempo
-    float lastChangeTick = 0; // tick for the last event that defines a new tempo
-    float lastTempo = 0; // will be set in the for loop below
-    float currentTick = -1; // will be set in the first iteration
-
-    for (const auto& frame: alignmentResults) {
-        Feature feature;
-        feature.hasTimestamp = true;
-        feature.timestamp = m_firstFrameTime + Vamp::RealTime::frame2RealTime(frame*(128.*6.), m_inputSampleRate);
-        std::cerr <<"event="<<event<< ", real time = "<<feature.timestamp << '\n';
-        Score::MeasureInfo info = eventList[event].measureInfo;
-        // Calculate label:
-        feature.label = to_string(info.measureNumber);
-        feature.label += "+" + to_string(info.measurePosition.numerator) + "/" + to_string(info.measurePosition.denominator);
-        
-        // Calculate tick:
-        // TODO: check divide-by-zero for eventList[event].temp and info.measureFraction.denominator
-        if (event == 0) {
-            lastTempo = eventList[0].tempo;
-            currentTick = info.measureFraction.numerator * 2000. * (120. / lastTempo) 
-            / info.measureFraction.denominator; // in case the first event is e.g., 1+1/8 in stead of 1+0/1
-            lastChangeTick = currentTick;
-        } else {
-            float currentTempo = eventList[event].tempo;
-            Fraction duration = info.measureFraction - eventList[lastChange].measureInfo.measureFraction;
-            currentTick = lastChangeTick + duration.numerator * 2000. * (120. / lastTempo) / duration.denominator;
-            if (abs(currentTempo - lastTempo) > 0.001) { // encountering a tempo change
-                lastTempo = currentTempo;
-                lastChange = event;
-                lastChangeTick = currentTick;
+    if (alignmentResults.empty()) {
+        alignmentResults =
+            m_segmentParallel ? m_aligner->alignInParallel() : m_aligner->align();
+        if (cache.isEnabled() && !alignmentResults.empty()) {
+            const Score& score = m_aligner->getScore();
+            int startEvent = m_aligner->getStartEvent();
+            onsets.clear();
+            for (int i = 0; i < int(alignmentResults.size()); i++) {
+                int frame = alignmentResults[i];
+                onsets.push_back({ frame, frame * m_aligner->getHopSize() / m_inputSampleRate,
+                                   score.getEventSeconds(startEvent + i) * 1000. });
             }
+            cache.store(key, onsets);
         }
-        std::cerr<<"***TICKS: "<<feature.label<<" -> "<<currentTick<<std::endl;
-        // feature.values.push_back(info.measureFraction.numerator * 2000 / info.measureFraction.denominator);
-        feature.values.push_back(currentTick);
-        featureSet[3].push_back(feature);
-        frames.push_back(frame);
-        event++;
     }
+    double alignSeconds = std::chrono::duration<double>
+        (std::chrono::steady_clock::now() - start).count();
+
+    addOnsetFeatures(alignmentResults, featureSet[3]);
 
 /*
     // Show onsets. TODO: deal with this part in SimpleHMM instead of here.
@@ -539,44 +725,16 @@ PianoAligner::getRemainingFeatures()
     }
     */
 
-    // Show local tempo. TODO: deal with this part in SimpleHMM instead of here.
-    for (int i = 0; i + 1 < int(frames.size()); i++) {
-        Feature feature;
-        feature.hasTimestamp = true;
-        feature.timestamp = Vamp::RealTime::frame2RealTime(frames[i]*(128.*6.), m_inputSampleRate);//featureSet[3][i];
-        double tempo = 100./(double)(frames[i+1] - frames[i]); // TODO: check != 0
-        feature.values.push_back(tempo);
-        featureSet[4].push_back(feature);
+    if (m_eventTempoOutput) {
+        addTempoFeatures(alignmentResults, featureSet[4]);
     }
 
-
-    // Testing: plot "normalized" PowerSpectrum
-    int scale = 6; // hard-coded for now
-    int bins = (m_blockSize/scale)/2;
-    double max = 0.;
-    double min = 100000000.; // a large value
-    double p = 0;
-    for (const auto& spectrum: m_aligner->getDataFeatures()) { // get max and min
-        for (int b = 0; b < bins; b++) {
-            p = spectrum[b];
-            if (p > max)    max = p;
-            if (p < min)    min = p;
-        }
-    }
-    double range = max-min; // Shouldn't be zero, but need to check
-    std::cout << "max = "<<max<<", min="<<min << '\n';
-    for (const auto& spectrum: m_aligner->getDataFeatures()) {
-        Feature feature;
-        feature.hasTimestamp = false;
-        feature.values.reserve(bins); // optional
-        for (int b = 0; b < bins; b++) {
-            p = spectrum[b];
-            feature.values.push_back(pow(log(1+p), 0.4));
-            //feature.values.push_back((p-min)/range);
-        }
-        featureSet[2].push_back(feature);
+    if (m_spectrumDecimation > 0) {
+        addPowerSpectrumFeatures(featureSet[2]);
     }
 
+    addStatsFeatures(alignSeconds, featureSet[5]);
+
 
 
     //Testing note templates:
@@ -608,3 +766,166 @@ PianoAligner::getRemainingFeatures()
 */
     return featureSet;
 }
+
+void
+PianoAligner::addOnsetFeatures(const AudioToScoreAligner::AlignmentResults& alignmentResults,
+                               FeatureList& features) const
+{
+    const Score& score = m_aligner->getScore();
+    const Score::MusicalEventList& eventList = score.getMusicalEvents();
+    int startEvent = m_aligner->getStartEvent();
+    int endEvent = startEvent + int(alignmentResults.size());
+
+    for (int event = startEvent; event < endEvent; event++) {
+        Score::MeasureInfo info = eventList[event].measureInfo;
+
+        // Ticks are the nominal time from the start of the score at the
+        // score's tempo, in milliseconds
+        float currentTick = score.getEventSeconds(event) * 1000.;
+
+        int frame = alignmentResults[event - startEvent];
+        Feature feature;
+        feature.hasTimestamp = true;
+        feature.timestamp = m_firstFrameTime + Vamp::RealTime::frame2RealTime(frame*(128.*6.), m_inputSampleRate);
+        LOG_DEBUG("event="<<event<< ", real time = "<<feature.timestamp);
+        // Calculate label:
+        feature.label = to_string(info.measureNumber);
+        feature.label += "+" + to_string(info.measurePosition.numerator) + "/" + to_string(info.measurePosition.denominator);
+        LOG_DEBUG("***TICKS: "<<feature.label<<" -> "<<currentTick);
+        // feature.values.push_back(info.measureFraction.numerator * 2000 / info.measureFraction.denominator);
+        feature.values.push_back(currentTick);
+        features.push_back(feature);
+    }
+}
+
+void
+PianoAligner::addTempoFeatures(const AudioToScoreAligner::AlignmentResults& frames,
+                               FeatureList& features) const
+{
+    // Show local tempo. TODO: deal with this part in SimpleHMM instead of here.
+    for (int i = 0; i + 1 < int(frames.size()); i++) {
+        Feature feature;
+        feature.hasTimestamp = true;
+        feature.timestamp = m_firstFrameTime + Vamp::RealTime::frame2RealTime(frames[i]*(128.*6.), m_inputSampleRate);
+        double tempo = 100./(double)(frames[i+1] - frames[i]); // TODO: check != 0
+        feature.values.push_back(tempo);
+        features.push_back(feature);
+    }
+}
+
+void
+PianoAligner::addPowerSpectrumFeatures(FeatureList& features) const
+{
+    // Testing: plot "normalized" PowerSpectrum, for every
+    // m_spectrumDecimation-th frame
+    int scale = 6; // hard-coded for now
+    int bins = (m_blockSize/scale)/2;
+    const auto& dataFeatures = m_aligner->getDataFeatures();
+    features.reserve(dataFeatures.size() / m_spectrumDecimation + 1);
+    for (size_t frame = 0; frame < dataFeatures.size(); frame += m_spectrumDecimation) {
+        const auto& spectrum = dataFeatures[frame];
+        Feature feature;
+        feature.hasTimestamp = false;
+        feature.values.reserve(bins); // optional
+        for (int b = 0; b < bins; b++) {
+            feature.values.push_back(pow(log(1+spectrum[b]), 0.4));
+        }
+        features.push_back(feature);
+    }
+}
+
+void
+PianoAligner::addStatsFeatures(double alignSeconds, FeatureList& features) const
+{
+    AlignmentStats::Values values = m_aligner->getStatistics();
+    values.insert(values.begin(), { "align.seconds", alignSeconds });
+
+    for (const auto& value : values) {
+        Feature feature;
+        feature.hasTimestamp = true;
+        feature.timestamp = m_firstFrameTime;
+        feature.label = value.first;
+        feature.values.push_back(value.second);
+        features.push_back(feature);
+    }
+
+    std::ostringstream summary;
+    for (const auto& value : values) {
+        summary << ' ' << value.first << '=' << value.second;
+    }
+    LOG_INFO("PianoAligner: alignment statistics:" << summary.str());
+
+    // Also as a JSON report, if asked for. Parameters can only be
+    // numbers, so the path comes from the environment.
+    const char* path = getenv("PIANO_ALIGNER_STATS_JSON");
+    if (path && *path && !AlignmentStats::writeJson(values, path)) {
+        LOG_WARNING("PianoAligner: failed to write statistics to " << path);
+    }
+}
+
+CacheKey
+PianoAligner::getResultKey() const
+{
+    // Parameters that only shape the other outputs or the scheduling
+    // are left out, so that changing them does not miss the cache
+    static const std::set<string> irrelevant = {
+        "spectrum-decimation", "event-tempo-output", "thread-priority",
+        "persist-likelihoods"
+    };
+
+    // The code versions too, so that an upgrade that would align
+    // differently never reuses results
+    CacheKey key;
+    key.add(double(ScoreCache::getVersion()));
+    key.add(double(AudioToScoreAligner::getLikelihoodModelVersion()));
+    key.add(m_inputSampleRate);
+    key.add(m_aligner->getHopSize());
+    key.add(m_blockSize);
+    key.add(m_aligner->getStartEvent());
+    key.add(m_aligner->getEndEvent());
+    for (const auto& descriptor : getParameterDescriptors()) {
+        if (irrelevant.count(descriptor.identifier)) continue;
+        key.add(descriptor.identifier);
+        key.add(getParameter(descriptor.identifier));
+    }
+    key.addScore(m_aligner->getScore());
+    key.addFeatures(m_aligner->getDataFeatures());
+    return key;
+}
+
+void
+PianoAligner::writeCapture(string path) const
+{
+    FeatureCapture capture;
+    capture.scoreName = m_scoreName;
+    capture.sampleRate = m_inputSampleRate;
+    capture.hopSize = m_aligner->getHopSize();
+    capture.blockSize = m_blockSize;
+    capture.firstFrameTime = m_firstFrameTime.sec + m_firstFrameTime.nsec / 1e9;
+    for (const auto& descriptor : getParameterDescriptors()) {
+        capture.parameters.push_back({ descriptor.identifier,
+                                       getParameter(descriptor.identifier) });
+    }
+    capture.startEvent = m_aligner->getStartEvent();
+    capture.endEvent = m_aligner->getEndEvent();
+    capture.coarseFactor = m_coarseFactor;
+    capture.bandWidth = m_bandWidth;
+    capture.bandRatio = m_bandTempoRatio;
+    capture.bandRescale = m_bandRescale;
+    capture.segmentParallel = m_segmentParallel;
+    capture.features = m_aligner->getDataFeatures();
+
+    // A directory gets a new file for each alignment
+    std::filesystem::path target = path;
+    std::error_code ec;
+    if (std::filesystem::is_directory(target, ec)) {
+        auto now = std::chrono::system_clock::now().time_since_epoch();
+        target /= m_scoreName + "-" +
+            std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(now).count()) +
+            ".capture";
+    }
+    if (capture.write(target)) {
+        LOG_INFO("PianoAligner: captured " << capture.features.size()
+                 << " frames to " << target.string());
+    }
+}
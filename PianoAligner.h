@@ -10,6 +10,7 @@
 #include <vamp-sdk/Plugin.h>
 
 #include "AudioToScoreAligner.h"
+#include "ResultCache.h"
 
 using std::string;
 
@@ -62,11 +63,48 @@ protected:
     float m_scorePositionEnd;
     float m_audioStart_sec;
     float m_audioEnd_sec;
+
+    // Split at confident points and align the segments in parallel
+    bool m_segmentParallel;
+
+    // Pool this many frames for a coarse first pass (1 means don't)
+    int m_coarseFactor;
+
+    // Band around the nominal tempo timeline (width < 0 means no band)
+    float m_bandWidth;
+    float m_bandTempoRatio;
+    bool m_bandRescale;
+
+    // Diagnostic outputs: the power spectrum is rendered for every
+    // m_spectrumDecimation-th frame (0 means not at all), and the
+    // event tempo only if m_eventTempoOutput is set
+    int m_spectrumDecimation;
+    bool m_eventTempoOutput;
+
+    // Of this instance's work in the thread pool shared by all of them
+    ThreadPool::Priority m_threadPriority;
+
+    // Keep likelihoods on disk for reuse by later runs
+    bool m_persistLikelihoods;
     
     bool m_isFirstFrame;
     Vamp::RealTime m_firstFrameTime;
     int m_frameCount;
     string m_scoreName;
+
+    // Producers for each output, called only for those wanted
+    void addOnsetFeatures(const AudioToScoreAligner::AlignmentResults& results,
+                          FeatureList& features) const;
+    void addTempoFeatures(const AudioToScoreAligner::AlignmentResults& results,
+                          FeatureList& features) const;
+    void addPowerSpectrumFeatures(FeatureList& features) const;
+    void addStatsFeatures(double alignSeconds, FeatureList& features) const;
+
+    // Record the aligner's input, see FeatureCapture
+    void writeCapture(string path) const;
+
+    // Everything the alignment depends on, for the result cache
+    CacheKey getResultKey() const;
 };
 
 
@@ -0,0 +1,108 @@
+/*
+  Finished alignments, kept on disk under a hash of everything they
+  depend on.
+*/
+
+#include "ResultCache.h"
+#include "Log.h"
+
+#include <cstring>
+#include <fstream>
+
+using std::filesystem::path;
+
+// Bump this whenever the layout below changes, or a change to the
+// aligner would change its results, so that older ones are not reused
+static const uint32_t RESULT_VERSION = 2;
+
+static const char RESULT_MAGIC[8] = { 'P', 'A', 'R', 'E', 'S', 'U', 'L', 'T' };
+static const uint32_t ENDIAN_TAG = 0x01020304;
+static const char* RESULT_EXTENSION = ".result";
+static const uint64_t DEFAULT_MAX_MEGABYTES = 64;
+
+// On-disk layout: the header and then the onsets, in native byte
+// order (ENDIAN_TAG rejects a file from a machine with the other one)
+
+struct ResultHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t endianTag;
+    uint64_t key[2]; // in full, in case of a clash in the file name
+    uint32_t onsetCount;
+    uint32_t reserved;
+};
+
+struct CachedOnset
+{
+    int32_t frame;
+    int32_t reserved;
+    double seconds;
+    double ticks;
+};
+
+ResultCache::ResultCache() :
+    m_files("results", RESULT_EXTENSION, "PIANO_ALIGNER_RESULT_CACHE_MB", DEFAULT_MAX_MEGABYTES)
+{
+}
+
+ResultCache::ResultCache(path dir, uint64_t maxBytes) :
+    m_files(dir, RESULT_EXTENSION, maxBytes)
+{
+}
+
+bool ResultCache::isEnabled() const
+{
+    return m_files.isEnabled();
+}
+
+bool ResultCache::find(const CacheKey& key, vector<Onset>& onsets) const
+{
+    if (!m_files.isEnabled()) return false;
+    path p = m_files.getPath(key);
+    std::ifstream in(p, std::ios::binary);
+    if (!in) return false;
+
+    ResultHeader header;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        memcmp(header.magic, RESULT_MAGIC, sizeof(RESULT_MAGIC)) != 0 ||
+        header.version != RESULT_VERSION || header.endianTag != ENDIAN_TAG ||
+        header.key[0] != key.getHash(0) || header.key[1] != key.getHash(1)) {
+        LOG_WARNING("ResultCache: ignoring incompatible result " << p);
+        return false;
+    }
+    vector<CachedOnset> cached(header.onsetCount);
+    if (!in.read(reinterpret_cast<char*>(cached.data()), cached.size() * sizeof(CachedOnset))) {
+        LOG_WARNING("ResultCache: result " << p << " is truncated");
+        return false;
+    }
+
+    onsets.clear();
+    for (const auto& c : cached) {
+        onsets.push_back({ c.frame, c.seconds, c.ticks });
+    }
+
+    m_files.touch(key);
+    return true;
+}
+
+bool ResultCache::store(const CacheKey& key, const vector<Onset>& onsets)
+{
+    if (!m_files.isEnabled()) return false;
+
+    ResultHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RESULT_MAGIC, sizeof(RESULT_MAGIC));
+    header.version = RESULT_VERSION;
+    header.endianTag = ENDIAN_TAG;
+    header.key[0] = key.getHash(0);
+    header.key[1] = key.getHash(1);
+    header.onsetCount = onsets.size();
+
+    string contents(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const auto& onset : onsets) {
+        CachedOnset cached = { onset.frame, 0, onset.seconds, onset.ticks };
+        contents.append(reinterpret_cast<const char*>(&cached), sizeof(cached));
+    }
+    return m_files.write(key, contents);
+}
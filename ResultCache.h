@@ -0,0 +1,57 @@
+/*
+  Finished alignments, kept on disk under a hash of everything they
+  depend on (the features, the compiled score and the settings), so
+  that aligning the same recording to the same score in the same way
+  again costs no more than reading a small file. The cache is bounded
+  in size, evicting the least recently used alignments first.
+*/
+
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include "CacheKey.h"
+#include "DiskCache.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+using std::vector;
+
+
+class ResultCache
+{
+public:
+    // One aligned event: its frame, its onset in seconds from the first
+    // frame, and its nominal time from the start of the score in
+    // milliseconds
+    struct Onset
+    {
+        int32_t frame;
+        double seconds;
+        double ticks;
+    };
+
+    // The cache in the "results" folder of Paths::getCacheDirectory(),
+    // bounded to PIANO_ALIGNER_RESULT_CACHE_MB megabytes (64 if unset).
+    // Disabled if that is 0, or if there is no cache directory.
+    ResultCache();
+
+    ResultCache(std::filesystem::path dir, uint64_t maxBytes);
+
+    bool isEnabled() const;
+
+    // The onsets stored under key, if any, marking them as just used
+    bool find(const CacheKey& key, vector<Onset>& onsets) const;
+
+    // Store onsets under key, then evict the least recently used
+    // alignments until the cache is within its bound again. Returns
+    // false if the onsets could not be written, which is not otherwise
+    // an error.
+    bool store(const CacheKey& key, const vector<Onset>& onsets);
+
+private:
+    DiskCache m_files;
+};
+
+#endif
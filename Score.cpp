@@ -2,11 +2,19 @@
   Yucong Jiang, June 2021
 */
 #include "Score.h"
-
+#include "Log.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <string_view>
 
 
 
@@ -15,8 +23,144 @@
 
 using namespace std;
 
-Score::Score()
+namespace {
+
+// Reads tab-separated fields a line at a time from a whole file held
+// in memory, reporting any error with its line and column
+class FieldReader
+{
+public:
+    FieldReader(const string &path, const MappedFile &file) :
+        m_path(path), m_next(file.getData()),
+        m_end(file.getData() + file.getSize()),
+        m_lineStart(m_next), m_lineEnd(m_next), m_pos(m_next), m_line(0) { }
+
+    // Move to the next line that is not blank; false at end of file
+    bool nextLine() {
+        while (m_next < m_end) {
+            m_lineStart = m_next;
+            const char *nl = (const char *)memchr(m_next, '\n', m_end - m_next);
+            m_lineEnd = nl ? nl : m_end;
+            m_next = nl ? nl + 1 : m_end;
+            ++m_line;
+            if (m_lineEnd > m_lineStart && m_lineEnd[-1] == '\r') --m_lineEnd;
+            m_pos = m_lineStart;
+            for (const char *p = m_lineStart; p < m_lineEnd; ++p) {
+                if (!isspace((unsigned char)*p)) return true;
+            }
+        }
+        return false;
+    }
+
+    // Each of these reads a field ending at sep (or at a tab, or the
+    // end of the line, if sep is a tab) and moves past it
+    bool readInt(char sep, int &value) {
+        const char *start, *end;
+        if (!field(sep, start, end)) return false;
+        return parseInt(start, end, value);
+    }
+
+    bool readFloat(char sep, float &value) {
+        const char *start, *end;
+        if (!field(sep, start, end)) return false;
+        // Not from_chars, as some of the standard libraries we build
+        // against lack the floating-point overloads
+        trim(start, end);
+        char buffer[64];
+        size_t n = end - start;
+        if (n == 0 || n >= sizeof(buffer)) return error(start, "expected a number");
+        memcpy(buffer, start, n);
+        buffer[n] = '\0';
+        char *parsed = nullptr;
+        value = strtof(buffer, &parsed);
+        if (parsed != buffer + n) return error(start + (parsed - buffer), "expected a number");
+        return true;
+    }
+
+    // If text is given it receives the field exactly as written
+    bool readFraction(char sep, Fraction &value, string_view *text = nullptr) {
+        const char *start, *end;
+        if (!field(sep, start, end)) return false;
+        if (text) *text = string_view(start, end - start);
+        const char *slash = (const char *)memchr(start, '/', end - start);
+        if (!slash) return error(start, "expected a fraction");
+        int n, d;
+        if (!parseInt(start, slash, n) || !parseInt(slash + 1, end, d)) return false;
+        if (n == 0 && d == 0) return error(start, "fraction 0/0");
+        value = Fraction(n, d);
+        return true;
+    }
+
+    bool skipField(char sep) {
+        const char *start, *end;
+        return field(sep, start, end);
+    }
+
+private:
+    string m_path;
+    const char *m_next;
+    const char *m_end;
+    const char *m_lineStart;
+    const char *m_lineEnd;
+    const char *m_pos;
+    int m_line;
+
+    bool field(char sep, const char *&start, const char *&end) {
+        start = m_pos;
+        end = m_pos;
+        while (end < m_lineEnd && *end != sep && *end != '\t') ++end;
+        if (end < m_lineEnd && *end == sep) {
+            m_pos = end + 1;
+        } else if (sep == '\t') {
+            m_pos = end;
+        } else {
+            return error(end, string("expected '") + sep + "'");
+        }
+        return true;
+    }
+
+    static void trim(const char *&start, const char *&end) {
+        while (start < end && isspace((unsigned char)*start)) ++start;
+        while (end > start && isspace((unsigned char)end[-1])) --end;
+    }
+
+    bool parseInt(const char *start, const char *end, int &value) {
+        trim(start, end);
+        if (start < end && *start == '+') ++start; // as stoi allowed
+        auto result = from_chars(start, end, value);
+        if (result.ec == errc::result_out_of_range) {
+            return error(start, "integer out of range");
+        }
+        if (result.ec != errc() || result.ptr != end || start == end) {
+            return error(result.ec == errc() ? result.ptr : start, "expected an integer");
+        }
+        return true;
+    }
+
+    bool error(const char *at, const string &message) {
+        LOG_ERROR(m_path << ":" << m_line << ":" << (at - m_lineStart + 1)
+                  << ": " << message << ": \"" << string(m_lineStart, m_lineEnd)
+                  << "\"");
+        return false;
+    }
+};
+
+}
+
+Score::Score() :
+    m_ticksPerWholeNote{1}, m_eventsInOrder{true}
+{
+    buildEventArrays();
+}
+
+Score::Score(MusicalEventList events, TempoChangeList tempoChanges,
+             MeterChangeList meterChanges) :
+    m_musicalEvents{std::move(events)},
+    m_tempoChanges{std::move(tempoChanges)},
+    m_meterChanges{std::move(meterChanges)},
+    m_ticksPerWholeNote{1}, m_eventsInOrder{true}
 {
+    buildEventArrays();
 }
 
 Score::~Score()
@@ -26,50 +170,30 @@ Score::~Score()
 // The last event in scoreFilePath is ignored (all out notes).
 bool Score::initialize(string scoreFilePath)
 {
-    string line;
-    string currentMeasure = "";
+    string_view currentMeasure = "";
     vector<Note> continuingNotes;
     MeasureInfo mi(0, Fraction(), Fraction());
     MusicalEvent currentEvent(mi); // to be replaced later
 
-    ifstream scoreFile(scoreFilePath);
-    if (!scoreFile.good()) {
-        cerr<<"Cannot open file "<<scoreFilePath<<"\n";
+    auto scoreFile = MappedFile::open(scoreFilePath);
+    if (!scoreFile) {
+        LOG_ERROR("Cannot open file "<<scoreFilePath);
         return false;
     }
 
-    while (getline(scoreFile, line)) {
-        istringstream iss(line);
-
-        // measure+Position
-        string measureAndPosition;
-        getline(iss, measureAndPosition, '\t');
-        string mn, mp;
-        istringstream measureString(measureAndPosition);
-        getline(measureString, mn, '+');
-        getline(measureString, mp, '+');
-        int measureNumber = stoi(mn);
-        Fraction measurePosition = Fraction::fromString(mp);
-
-        // measure
-        string m;
-        getline(iss, m, '\t');
-        Fraction measureFraction = Fraction::fromString(m);
-
-        // skip
-        string placeholder;
-        getline(iss, placeholder, '\t');
-
-        // midi number
-        string midiString;
-        getline(iss, midiString, '\t');
-        int midi = stoi(midiString);
-
-        // in: non-zero; out: 0
-        string s;
-        getline(iss, s, '\t');
-        int velocity = stoi(s);
-
+    FieldReader reader(scoreFilePath, *scoreFile);
+    while (reader.nextLine()) {
+        int measureNumber, midi, velocity; // velocity in: non-zero; out: 0
+        Fraction measurePosition, measureFraction;
+        string_view m; // the measure as written, identifying the event
+        if (!reader.readInt('+', measureNumber) ||
+            !reader.readFraction('\t', measurePosition) ||
+            !reader.readFraction('\t', measureFraction, &m) ||
+            !reader.skipField('\t') ||
+            !reader.readInt('\t', midi) ||
+            !reader.readInt('\t', velocity)) {
+            return false;
+        }
 
         if (m != currentMeasure) { // new event
 
@@ -78,8 +202,8 @@ bool Score::initialize(string scoreFilePath)
                 for (Note note: continuingNotes)
                     currentEvent.notes.push_back(Note(false, note.midiNumber));
                 currentEvent.duration = measureFraction - currentEvent.measureInfo.measureFraction;
-                m_musicalEvents.push_back(currentEvent);
                 continuingNotes = currentEvent.notes;
+                m_musicalEvents.push_back(std::move(currentEvent));
             }
 
             currentEvent = MusicalEvent(MeasureInfo(
@@ -100,6 +224,7 @@ bool Score::initialize(string scoreFilePath)
             currentEvent.notes.push_back(Note(true, midi));
     }
 
+    buildEventArrays();
     return true;
 }
 
@@ -107,38 +232,26 @@ bool Score::initialize(string scoreFilePath)
 // Read in the tempo information and assign a tempo value for each event in MusicalEvent
 bool Score::readTempo(string tempoFilePath)
 {
-    string line;
     MeasureInfo mi(0, Fraction(), Fraction());
     TempoChange currentTempo(mi, 120.0, 1.0); // to be replaced soon
 
-    ifstream tempoFile(tempoFilePath);
-    if (!tempoFile.good()) {
-        cerr<<"Cannot open file "<<tempoFilePath<<"\n";
+    auto tempoFile = MappedFile::open(tempoFilePath);
+    if (!tempoFile) {
+        LOG_ERROR("Cannot open file "<<tempoFilePath);
         return false;
     }
 
-    while (getline(tempoFile, line)) {
-        istringstream iss(line);
-
-        // measure+Position
-        string measureAndPosition;
-        getline(iss, measureAndPosition, '\t');
-        string mn, mp;
-        istringstream measureString(measureAndPosition);
-        getline(measureString, mn, '+');
-        getline(measureString, mp, '+');
-        int measureNumber = stoi(mn);
-        Fraction measurePosition = Fraction::fromString(mp);
-
-        // tempo value
-        string tempoString;
-        getline(iss, tempoString, '\t');
-        float tempo = stof(tempoString);
-
-        // note length for the tempo
-        string nlString;
-        getline(iss, nlString, '\t');
-        float noteLength = stof(nlString);
+    FieldReader reader(tempoFilePath, *tempoFile);
+    while (reader.nextLine()) {
+        int measureNumber;
+        Fraction measurePosition;
+        float tempo, noteLength; // noteLength is the note the tempo is given in
+        if (!reader.readInt('+', measureNumber) ||
+            !reader.readFraction('\t', measurePosition) ||
+            !reader.readFloat('\t', tempo) ||
+            !reader.readFloat('\t', noteLength)) {
+            return false;
+        }
 
         m_tempoChanges.push_back(TempoChange(MeasureInfo(measureNumber,
          measurePosition, measurePosition), tempo, noteLength)); // dummy measureFraction
@@ -148,13 +261,31 @@ bool Score::readTempo(string tempoFilePath)
         m_musicalEvents[count].tempo = 120.; // default tempo is "quarter note = 120."
     }
 
-    // Apply any tempo changes to relevant events
-    for (int count = 0; count + 1 < m_tempoChanges.size(); count++) {
-        TempoChange start = m_tempoChanges[count];
-        TempoChange end = m_tempoChanges[count+1];
-        for (auto &event: m_musicalEvents)
-            if (event.measureInfo >= start.measureInfo && event.measureInfo < end.measureInfo)
-                event.tempo = start.newTempo * start.noteLength;
+    // Apply any tempo changes to relevant events. When the changes are
+    // in order, each event simply takes the last one at or before it.
+    auto before = [](const MeasureInfo &mi, const TempoChange &change) {
+        return mi < change.measureInfo;
+    };
+    if (is_sorted(m_tempoChanges.begin(), m_tempoChanges.end(),
+                  [](const TempoChange &a, const TempoChange &b) {
+                      return a.measureInfo < b.measureInfo;
+                  })) {
+        for (auto &event: m_musicalEvents) {
+            auto itr = upper_bound(m_tempoChanges.begin(), m_tempoChanges.end(),
+                                   event.measureInfo, before);
+            if (itr != m_tempoChanges.begin()) {
+                --itr;
+                event.tempo = itr->newTempo * itr->noteLength;
+            }
+        }
+    } else {
+        for (int count = 0; count + 1 < m_tempoChanges.size(); count++) {
+            TempoChange start = m_tempoChanges[count];
+            TempoChange end = m_tempoChanges[count+1];
+            for (auto &event: m_musicalEvents)
+                if (event.measureInfo >= start.measureInfo && event.measureInfo < end.measureInfo)
+                    event.tempo = start.newTempo * start.noteLength;
+        }
     }
     if (m_tempoChanges.size() > 0) {
         TempoChange last = m_tempoChanges[m_tempoChanges.size()-1];
@@ -164,10 +295,11 @@ bool Score::readTempo(string tempoFilePath)
     }
     // testing:
     for (auto &event: m_musicalEvents) {
-        cerr<<"***TEMPO: "<<event.measureInfo.measureNumber<<"+"
-                 <<event.measureInfo.measurePosition<<" -> "<<event.tempo<<endl;
+        LOG_DEBUG("***TEMPO: "<<event.measureInfo.measureNumber<<"+"
+                  <<event.measureInfo.measurePosition<<" -> "<<event.tempo);
     }
 
+    buildEventArrays();
     return true;
 }
 
@@ -175,51 +307,59 @@ bool Score::readTempo(string tempoFilePath)
 // Read in the meter information and assign a meter value for each event in MusicalEvent
 bool Score::readMeter(string meterFilePath)
 {
-    string line;
     MeterChange currentMeter(0, 0, 0); // to be replaced soon
 
-    ifstream meterFile(meterFilePath);
-    if (!meterFile.good()) {
-        cerr<<"Cannot open file "<<meterFilePath<<"\n";
+    auto meterFile = MappedFile::open(meterFilePath);
+    if (!meterFile) {
+        LOG_ERROR("Cannot open file "<<meterFilePath);
         return false;
     }
 
-    while (getline(meterFile, line)) {
-        istringstream iss(line);
-
-        // measure num
-        string mString;
-        getline(iss, mString, '\t');
-        int measureNum = stoi(mString);
-
-        // meter
-        string meterString;
-        getline(iss, meterString, '\t');
-        string n, d;
-        istringstream meter(meterString);
-        getline(meter, n, '/');
-        getline(meter, d, '/');
-        int meterNume = stoi(n);
-        int meterDeno = stoi(d);
+    FieldReader reader(meterFilePath, *meterFile);
+    while (reader.nextLine()) {
+        int measureNum, meterNume, meterDeno;
+        if (!reader.readInt('\t', measureNum) ||
+            !reader.readInt('/', meterNume) ||
+            !reader.readInt('\t', meterDeno)) {
+            return false;
+        }
 
         m_meterChanges.push_back(MeterChange(measureNum, meterNume, meterDeno));
     }
 
     if (m_meterChanges.empty()) {
-        cerr<<"ERROR in Score::readMeter: meterChanges is empty!";
+        LOG_ERROR("ERROR in Score::readMeter: meterChanges is empty!");
         return false;
     }
 
-    // Apply any meter changes to relevant events
-    for (int count = 0; count + 1 < m_meterChanges.size(); count++) {
-        MeterChange start = m_meterChanges[count];
-        MeterChange end = m_meterChanges[count+1];
-        for (auto &event: m_musicalEvents)
-            if (event.measureInfo.measureNumber >= start.measureNumber &&
-             event.measureInfo.measureNumber < end.measureNumber) {
-                event.meterNumer = start.numer;
-                event.meterDenom = start.denom;
+    // Apply any meter changes to relevant events, as for tempo
+    auto before = [](int measureNumber, const MeterChange &change) {
+        return measureNumber < change.measureNumber;
+    };
+    if (is_sorted(m_meterChanges.begin(), m_meterChanges.end(),
+                  [](const MeterChange &a, const MeterChange &b) {
+                      return a.measureNumber < b.measureNumber;
+                  })) {
+        for (auto &event: m_musicalEvents) {
+            auto itr = upper_bound(m_meterChanges.begin(), m_meterChanges.end(),
+                                   event.measureInfo.measureNumber, before);
+            if (itr != m_meterChanges.begin()) {
+                --itr;
+                event.meterNumer = itr->numer;
+                event.meterDenom = itr->denom;
             }
+        }
+    } else {
+        for (int count = 0; count + 1 < m_meterChanges.size(); count++) {
+            MeterChange start = m_meterChanges[count];
+            MeterChange end = m_meterChanges[count+1];
+            for (auto &event: m_musicalEvents)
+                if (event.measureInfo.measureNumber >= start.measureNumber &&
+                 event.measureInfo.measureNumber < end.measureNumber) {
+                    event.meterNumer = start.numer;
+                    event.meterDenom = start.denom;
+                }
+        }
     }
 
     MeterChange last = m_meterChanges[m_meterChanges.size()-1];
@@ -230,11 +370,12 @@ bool Score::readMeter(string meterFilePath)
         }
     // testing:
     for (auto &event: m_musicalEvents) {
-        cerr<<"***METER: "<<event.measureInfo.measureNumber<<"+"
-                 <<event.measureInfo.measurePosition<<" -> "<<
-                 event.meterNumer<<"/"<<event.meterDenom<<endl;
+        LOG_DEBUG("***METER: "<<event.measureInfo.measureNumber<<"+"
+                  <<event.measureInfo.measurePosition<<" -> "<<
+                  event.meterNumer<<"/"<<event.meterDenom);
     }
 
+    buildEventArrays();
     return true;
 }
 
@@ -247,42 +388,223 @@ const Score::MusicalEventList& Score::getMusicalEvents() const
     return m_musicalEvents;
 }
 
-void Score::setEventTemplates(NoteTemplates& t)
+const Score::TempoChangeList& Score::getTempoChanges() const
 {
-    int bins = t[60].size();
-    if (bins <= 0) {
-        std::cerr << "setEventTemplates: Something is wrong with the note templates." << '\n';
-        return;
+    return m_tempoChanges;
+}
+
+const Score::MeterChangeList& Score::getMeterChanges() const
+{
+    return m_meterChanges;
+}
+
+static double getPositionInMeasures(const Score::MusicalEvent& event)
+{
+    double measureLength = 1.;
+    if (event.meterNumer > 0 && event.meterDenom > 0) {
+        measureLength = event.meterNumer / (double)event.meterDenom;
+    }
+    return event.measureInfo.measureNumber +
+        event.measureInfo.measurePosition.getValue() / measureLength;
+}
+
+int Score::getEventIndexForPosition(double position, bool inclusive) const
+{
+    if (m_eventsInOrder) {
+        auto itr = inclusive ?
+            lower_bound(m_eventMeasurePositions.begin(), m_eventMeasurePositions.end(), position) :
+            upper_bound(m_eventMeasurePositions.begin(), m_eventMeasurePositions.end(), position);
+        return int(itr - m_eventMeasurePositions.begin());
+    }
+    int count = 0;
+    for (double p: m_eventMeasurePositions) {
+        if (p > position || (inclusive && p == position)) {
+            return count;
+        }
+        count++;
+    }
+    return count;
+}
+
+int Score::getEventIndexForMeasure(const MeasureInfo& measureInfo, bool inclusive) const
+{
+    auto isAfter = [&](const MusicalEvent &event) {
+        return measureInfo < event.measureInfo ||
+            (inclusive && measureInfo == event.measureInfo);
+    };
+    if (m_eventsInOrder) {
+        auto itr = partition_point(m_musicalEvents.begin(), m_musicalEvents.end(),
+                                   [&](const MusicalEvent &event) {
+                                       return !isAfter(event);
+                                   });
+        return int(itr - m_musicalEvents.begin());
+    }
+    int count = 0;
+    for (const auto &event: m_musicalEvents) {
+        if (isAfter(event)) {
+            return count;
+        }
+        count++;
+    }
+    return count;
+}
+
+int64_t Score::getTicksPerWholeNote() const
+{
+    return m_ticksPerWholeNote;
+}
+
+int64_t Score::getEventTicks(int event) const
+{
+    return m_eventTicks[event];
+}
+
+double Score::getEventSeconds(int event) const
+{
+    return m_eventSeconds[event];
+}
+
+double Score::getEventMeasurePosition(int event) const
+{
+    return m_eventMeasurePositions[event];
+}
+
+Score::EventArrays Score::getEventArrays() const
+{
+    EventArrays arrays;
+    arrays.count = m_musicalEvents.size();
+    arrays.noteStart = m_noteStart.data();
+    arrays.noteMidi = m_noteMidi.data();
+    arrays.noteIsNew = m_noteIsNew.data();
+    arrays.tempo = m_eventTempo.data();
+    arrays.duration = m_eventDuration.data();
+    arrays.meterNumer = m_eventMeterNumer.data();
+    arrays.meterDenom = m_eventMeterDenom.data();
+    arrays.ticks = m_eventTicks.data();
+    arrays.seconds = m_eventSeconds.data();
+    arrays.measurePosition = m_eventMeasurePositions.data();
+    return arrays;
+}
+
+void Score::buildEventArrays()
+{
+    int events = m_musicalEvents.size();
+
+    m_noteStart.clear();
+    m_noteMidi.clear();
+    m_noteIsNew.clear();
+    m_eventTempo.clear();
+    m_eventDuration.clear();
+    m_eventMeterNumer.clear();
+    m_eventMeterDenom.clear();
+    for (const auto &event: m_musicalEvents) {
+        m_noteStart.push_back(m_noteMidi.size());
+        for (const auto &note: event.notes) {
+            m_noteMidi.push_back(note.midiNumber);
+            m_noteIsNew.push_back(note.isNewNote ? 1 : 0);
+        }
+        m_eventTempo.push_back(event.tempo);
+        const Fraction &d = event.duration;
+        m_eventDuration.push_back(d.denominator == 0 ? 0. : d.numerator / (double)d.denominator);
+        m_eventMeterNumer.push_back(event.meterNumer);
+        m_eventMeterDenom.push_back(event.meterDenom);
+    }
+    m_noteStart.push_back(m_noteMidi.size());
+
+    m_eventTicks.assign(events + 1, 0);
+    m_eventSeconds.assign(events + 1, 0.);
+    m_eventMeasurePositions.assign(events, 0.);
+    m_ticksPerWholeNote = 1;
+    m_eventsInOrder = true;
+    if (events == 0) return;
+
+    // The resolution is the lowest common multiple of the denominators,
+    // unless that gets silly, in which case positions are rounded
+    const int64_t maxTicksPerWholeNote = int64_t(1) << 40;
+    auto addDenominator = [&](int64_t d) {
+        if (d < 0) d = -d;
+        if (d == 0) return;
+        int64_t g = Fraction::gcd(m_ticksPerWholeNote, d);
+        if (m_ticksPerWholeNote / g > maxTicksPerWholeNote / d) return;
+        m_ticksPerWholeNote = m_ticksPerWholeNote / g * d;
+    };
+    for (const auto &event: m_musicalEvents) {
+        addDenominator(event.measureInfo.measureFraction.denominator);
+    }
+    addDenominator(m_musicalEvents[events-1].duration.denominator);
+
+    auto toTicks = [&](const Fraction &f) -> int64_t {
+        if (f.denominator == 0) return 0;
+        if (m_ticksPerWholeNote % f.denominator == 0) {
+            return f.numerator * (m_ticksPerWholeNote / f.denominator);
+        }
+        return llround(f.getValue() * m_ticksPerWholeNote);
+    };
+    for (int event = 0; event < events; event++) {
+        const MusicalEvent &e = m_musicalEvents[event];
+        m_eventTicks[event] = toTicks(e.measureInfo.measureFraction);
+        m_eventMeasurePositions[event] = getPositionInMeasures(e);
+        if (event > 0 &&
+            (e.measureInfo < m_musicalEvents[event-1].measureInfo ||
+             m_eventMeasurePositions[event] < m_eventMeasurePositions[event-1])) {
+            m_eventsInOrder = false;
+        }
+    }
+    m_eventTicks[events] = m_eventTicks[events-1] +
+        toTicks(m_musicalEvents[events-1].duration);
+
+    // Seconds accumulate piecewise from each change of tempo. Tempo is
+    // in quarter notes per minute, so a whole note lasts 240/tempo.
+    auto tempoOf = [&](int event) {
+        float tempo = m_musicalEvents[event].tempo;
+        return tempo > 0.f ? tempo : 120.f;
+    };
+    float lastTempo = tempoOf(0);
+    int64_t lastChangeTicks = 0;
+    double lastChangeSeconds = 0.;
+    for (int event = 0; event <= events; event++) {
+        m_eventSeconds[event] = lastChangeSeconds +
+            (m_eventTicks[event] - lastChangeTicks) * 240. /
+            (double(m_ticksPerWholeNote) * lastTempo);
+        if (event < events && abs(tempoOf(event) - lastTempo) > 0.001) {
+            lastTempo = tempoOf(event);
+            lastChangeTicks = m_eventTicks[event];
+            lastChangeSeconds = m_eventSeconds[event];
+        }
     }
+}
+
+Template Score::makeEventTemplate(const int32_t* midis, int count, NoteTemplates& t)
+{
+    int bins = t[60].size();
     double smallValue = 1 / (double)bins;
     double backgroundPortion = 0.05;
 
-    for (auto &event: m_musicalEvents) {
-        event.eventTemplate.resize(bins, 0);
-        for (const auto &note: event.notes) {
-            int midi = note.midiNumber;
-            for (int k = 0; k < bins; k++) {
-                event.eventTemplate[k] += t[midi][k];
-            }
+    Template eventTemplate(bins, 0);
+    for (int n = 0; n < count; n++) {
+        int midi = midis[n];
+        for (int k = 0; k < bins; k++) {
+            eventTemplate[k] += t[midi][k];
         }
-        // Normalize:
-        double total = 0;
-        for (const auto &value: event.eventTemplate) {
-            total += value;
+    }
+    // Normalize:
+    double total = 0;
+    for (const auto &value: eventTemplate) {
+        total += value;
+    }
+    if (total == 0) {
+        for (auto &value: eventTemplate) {
+            value = smallValue;
         }
-        if (total == 0) {
-            for (auto &value: event.eventTemplate) {
-                value = smallValue;
-            }
-        } else {
-            for (auto &value: event.eventTemplate) {
-                value /= total;
-            }
-            for (auto &value: event.eventTemplate) {
-                value = smallValue*backgroundPortion + value*(1-backgroundPortion);
-            }
+    } else {
+        for (auto &value: eventTemplate) {
+            value /= total;
+        }
+        for (auto &value: eventTemplate) {
+            value = smallValue*backgroundPortion + value*(1-backgroundPortion);
         }
     }
+    return eventTemplate;
 }
 
 /*
@@ -5,6 +5,7 @@
 #ifndef SCORE_H
 #define SCORE_H
 
+#include <cstdint>
 #include <iostream>
 #include <ostream>
 #include <sstream>
@@ -41,6 +42,14 @@ struct Fraction // Simplest form using GCD.
         }
     }
 
+    static int64_t gcd(int64_t p, int64_t q) {
+        if (q == 0) {
+            return p;
+        } else {
+            return gcd(q, p % q);
+        }
+    }
+
     static Fraction fromString(const string &s) {
         string n, d;
         istringstream iss(s);
@@ -67,20 +76,28 @@ struct Fraction // Simplest form using GCD.
 
     Fraction& operator=(const Fraction&) = default;
 
+    // These work in 64 bits, as the cross products can overflow an int
+
     bool operator<(const Fraction& other) const {
-        int n = numerator;
-    	int d = denominator;
-    	int nn = other.numerator;
-    	int dd = other.denominator;
+        int64_t n = numerator;
+    	int64_t d = denominator;
+    	int64_t nn = other.numerator;
+    	int64_t dd = other.denominator;
     	return (n * dd < nn * d);
     }
 
     Fraction operator-(const Fraction& other) const {
-        int n = numerator;
-    	int d = denominator;
-    	int nn = other.numerator;
-    	int dd = other.denominator;
-    	return (Fraction(n*dd - d*nn, d*dd));
+        int64_t n = numerator;
+    	int64_t d = denominator;
+    	int64_t nn = other.numerator;
+    	int64_t dd = other.denominator;
+        int64_t rn = n*dd - d*nn;
+        int64_t rd = d*dd;
+        int64_t div = gcd(rn, rd);
+        Fraction result;
+        result.numerator = int(rn/div);
+        result.denominator = int(rd/div);
+        return result;
     }
 };
 
@@ -131,13 +148,13 @@ public:
     {
         MeasureInfo measureInfo;
         vector<Note> notes;
-        Template eventTemplate;
         Fraction duration;
         float tempo; // e.g., Quarter note = 120.0
         int meterNumer; // e.g., 3
         int meterDenom; // e.g., 4
 
-        MusicalEvent(MeasureInfo mi) : measureInfo{mi} { }
+        MusicalEvent(MeasureInfo mi) : measureInfo{mi}, tempo{120.},
+         meterNumer{0}, meterDenom{0} { }
     };
 
     struct TempoChange
@@ -164,18 +181,93 @@ public:
     typedef vector<TempoChange> TempoChangeList;
     typedef vector<MeterChange> MeterChangeList;
 
+    // Construct from already-parsed contents, e.g. a score cache
+    Score(MusicalEventList events, TempoChangeList tempoChanges,
+          MeterChangeList meterChanges);
+
     bool initialize(string scoreFilePath);
     bool readTempo(string tempoFilePath);
     bool readMeter(string meterFilePath);
 
     const MusicalEventList& getMusicalEvents() const;
+    const TempoChangeList& getTempoChanges() const;
+    const MeterChangeList& getMeterChanges() const;
+
+    // Score positions are given in measures: the measure number plus
+    // the proportion of that measure elapsed, so 12.5 is halfway
+    // through measure 12. Returns the index of the first event at (or,
+    // if inclusive is false, strictly after) the given position, or
+    // the number of events if there is none.
+    int getEventIndexForPosition(double position, bool inclusive) const;
+
+    // As above, for a position given as measure number and position
+    // within the measure
+    int getEventIndexForMeasure(const MeasureInfo& measureInfo, bool inclusive) const;
+
+    // Read-only structure-of-arrays view of the events, for code that
+    // walks many of them. The notes of event e are those from
+    // noteStart[e] up to noteStart[e+1] in the note pool. Valid for as
+    // long as the Score is, and until it next reads a file.
+    struct EventArrays
+    {
+        int count;
+        const int32_t* noteStart; // count + 1
+        const int32_t* noteMidi;
+        const uint8_t* noteIsNew;
+        const float* tempo; // quarter notes per minute
+        const double* duration; // in whole notes
+        const int32_t* meterNumer;
+        const int32_t* meterDenom;
+        const int64_t* ticks; // count + 1, see getEventTicks
+        const double* seconds; // count + 1, see getEventSeconds
+        const double* measurePosition; // see getEventMeasurePosition
+    };
+
+    EventArrays getEventArrays() const;
+
+    // The score timeline, rebuilt along with the event arrays in a
+    // single sweep whenever the score, tempo or meter is read. Ticks
+    // and seconds may also be asked for at index
+    // getMusicalEvents().size(), meaning the end of the last event.
+
+    // Ticks per whole note: normally the lowest resolution at which
+    // every event position is a whole number of ticks
+    int64_t getTicksPerWholeNote() const;
 
-    void setEventTemplates(NoteTemplates& t);
+    // Position of an event from the start of the score, in ticks
+    int64_t getEventTicks(int event) const;
+
+    // Nominal time of an event from the start of the score, in seconds
+    // at the tempo given in the score
+    double getEventSeconds(int event) const;
+
+    // Position of an event in measures, as for getEventIndexForPosition
+    double getEventMeasurePosition(int event) const;
+
+    // The normalised template for a chord of the given MIDI notes
+    static Template makeEventTemplate(const int32_t* midis, int count, NoteTemplates& t);
 
 private:
     MusicalEventList m_musicalEvents;
     TempoChangeList m_tempoChanges;
     MeterChangeList m_meterChanges;
+
+    // Event arrays, see EventArrays
+    vector<int32_t> m_noteStart;
+    vector<int32_t> m_noteMidi;
+    vector<uint8_t> m_noteIsNew;
+    vector<float> m_eventTempo;
+    vector<double> m_eventDuration;
+    vector<int32_t> m_eventMeterNumer;
+    vector<int32_t> m_eventMeterDenom;
+
+    int64_t m_ticksPerWholeNote;
+    vector<int64_t> m_eventTicks;
+    vector<double> m_eventSeconds;
+    vector<double> m_eventMeasurePositions;
+    bool m_eventsInOrder; // if not, lookups fall back to a linear scan
+
+    void buildEventArrays();
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,463 @@
+/*
+  A compiled binary form of a score, stored next to its .solo file and
+  memory-mapped when loaded, so that neither the text files nor the
+  event templates need to be processed again.
+*/
+
+#include "ScoreCache.h"
+#include "Log.h"
+#include "MappedFile.h"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+using std::filesystem::path;
+using std::vector;
+
+// Bump this whenever the layout below, the score parser or the
+// template generation changes, so that older caches are rebuilt (and
+// likelihoods calculated from older templates are not reused)
+static const uint32_t CACHE_VERSION = 4;
+static const char CACHE_MAGIC[8] = { 'P', 'A', 'S', 'C', 'O', 'R', 'E', '\0' };
+static const uint32_t ENDIAN_TAG = 0x01020304;
+static const int SOURCE_COUNT = 3; // .solo, .tempo, .meter
+static const size_t SECTION_ALIGNMENT = ScoreCache::TEMPLATE_ALIGNMENT;
+
+// On-disk layout. Everything is in native byte order (ENDIAN_TAG
+// rejects a cache from a machine with the other one) and each section
+// starts on a SECTION_ALIGNMENT boundary.
+
+struct CacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t endianTag;
+    uint64_t sourceHash;
+    int64_t sourceTimes[SOURCE_COUNT];
+    uint64_t sourceSizes[SOURCE_COUNT];
+    uint32_t eventCount;
+    uint32_t noteCount;
+    uint32_t tempoCount;
+    uint32_t meterCount;
+    uint32_t geometryCount;
+    uint32_t reserved;
+    uint64_t eventsOffset;
+    uint64_t notesOffset;
+    uint64_t temposOffset;
+    uint64_t metersOffset;
+    uint64_t geometriesOffset;
+};
+
+struct CachedEvent
+{
+    int32_t measureNumber;
+    int32_t measurePosition[2];
+    int32_t measureFraction[2];
+    int32_t duration[2];
+    float tempo;
+    int32_t meterNumer;
+    int32_t meterDenom;
+    uint32_t firstNote;
+    uint32_t noteCount;
+};
+
+struct CachedNote
+{
+    int32_t isNewNote;
+    int32_t midiNumber;
+};
+
+struct CachedTempo
+{
+    int32_t measureNumber;
+    int32_t measurePosition[2];
+    int32_t measureFraction[2];
+    float newTempo;
+    float noteLength;
+};
+
+struct CachedMeter
+{
+    int32_t measureNumber;
+    int32_t numer;
+    int32_t denom;
+};
+
+struct CachedGeometry
+{
+    float sampleRate;
+    int32_t blockSize;
+    int32_t bins;
+    int32_t stride;
+    uint32_t templateCount;
+    uint64_t eventTemplatesOffset; // int32_t per event
+    uint64_t logTemplatesOffset; // double[templateCount][stride]
+};
+
+static Fraction makeFraction(const int32_t f[2])
+{
+    // Set the fields directly: they are already in lowest terms, and
+    // the constructor would divide by zero for a 0/0 placeholder
+    Fraction fraction;
+    fraction.numerator = f[0];
+    fraction.denominator = f[1];
+    return fraction;
+}
+
+static void storeFraction(const Fraction& fraction, int32_t f[2])
+{
+    f[0] = fraction.numerator;
+    f[1] = fraction.denominator;
+}
+
+static int64_t getModificationTime(const path& p)
+{
+    std::error_code ec;
+    auto time = std::filesystem::last_write_time(p, ec);
+    if (ec) return 0;
+    return time.time_since_epoch().count();
+}
+
+static uint64_t getFileSize(const path& p)
+{
+    std::error_code ec;
+    auto size = std::filesystem::file_size(p, ec);
+    if (ec) return 0;
+    return size;
+}
+
+uint32_t ScoreCache::getVersion()
+{
+    return CACHE_VERSION;
+}
+
+ScoreCache::ScoreCache(path scoreDir, string scoreName) :
+    m_dir{scoreDir}, m_name{scoreName}
+{
+    auto file = MappedFile::open(getCachePath());
+    if (!file) return;
+
+    const CacheHeader* header = file->at<CacheHeader>(0, 1);
+    if (!header || memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+        header->version != CACHE_VERSION || header->endianTag != ENDIAN_TAG) {
+        LOG_WARNING("ScoreCache: ignoring incompatible cache for " << m_name);
+        return;
+    }
+
+    bool unchanged = true;
+    for (int source = 0; source < SOURCE_COUNT; source++) {
+        path p = getSourcePath(source);
+        if (header->sourceTimes[source] != getModificationTime(p) ||
+            header->sourceSizes[source] != getFileSize(p)) {
+            unchanged = false;
+        }
+    }
+    if (!unchanged && header->sourceHash != getSourceHash()) {
+        LOG_INFO("ScoreCache: cache for " << m_name << " is out of date");
+        return;
+    }
+
+    if (!file->at<CachedEvent>(header->eventsOffset, header->eventCount) ||
+        !file->at<CachedNote>(header->notesOffset, header->noteCount) ||
+        !file->at<CachedTempo>(header->temposOffset, header->tempoCount) ||
+        !file->at<CachedMeter>(header->metersOffset, header->meterCount) ||
+        !file->at<CachedGeometry>(header->geometriesOffset, header->geometryCount)) {
+        LOG_WARNING("ScoreCache: cache for " << m_name << " is truncated");
+        return;
+    }
+
+    m_file = file;
+}
+
+ScoreCache::~ScoreCache()
+{
+}
+
+bool ScoreCache::isCurrent() const
+{
+    return bool(m_file);
+}
+
+path ScoreCache::getCachePath() const
+{
+    return m_dir / (m_name + ".scorecache");
+}
+
+path ScoreCache::getSourcePath(int source) const
+{
+    static const char* extensions[SOURCE_COUNT] = { ".solo", ".tempo", ".meter" };
+    return m_dir / (m_name + extensions[source]);
+}
+
+uint64_t ScoreCache::getSourceHash() const
+{
+    // 64-bit FNV-1a over the contents of all the source files, each
+    // followed by its length so that moving text between them counts
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&](const char* data, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            hash ^= (unsigned char)data[i];
+            hash *= 1099511628211ull;
+        }
+    };
+    for (int source = 0; source < SOURCE_COUNT; source++) {
+        std::ifstream in(getSourcePath(source), std::ios::binary);
+        char buffer[65536];
+        uint64_t length = 0;
+        while (in.read(buffer, sizeof(buffer)) || in.gcount() > 0) {
+            add(buffer, in.gcount());
+            length += in.gcount();
+        }
+        add(reinterpret_cast<const char*>(&length), sizeof(length));
+    }
+    return hash;
+}
+
+shared_ptr<const Score> ScoreCache::getScore() const
+{
+    if (!m_file) return nullptr;
+
+    const CacheHeader* header = m_file->at<CacheHeader>(0, 1);
+    const CachedEvent* events = m_file->at<CachedEvent>(header->eventsOffset, header->eventCount);
+    const CachedNote* notes = m_file->at<CachedNote>(header->notesOffset, header->noteCount);
+    const CachedTempo* tempos = m_file->at<CachedTempo>(header->temposOffset, header->tempoCount);
+    const CachedMeter* meters = m_file->at<CachedMeter>(header->metersOffset, header->meterCount);
+
+    Score::MusicalEventList eventList;
+    eventList.reserve(header->eventCount);
+    for (uint32_t i = 0; i < header->eventCount; i++) {
+        const CachedEvent& e = events[i];
+        if (e.firstNote > header->noteCount ||
+            e.noteCount > header->noteCount - e.firstNote) {
+            LOG_WARNING("ScoreCache: bad note range in cache for " << m_name);
+            return nullptr;
+        }
+        Score::MusicalEvent event(Score::MeasureInfo(e.measureNumber,
+            makeFraction(e.measurePosition), makeFraction(e.measureFraction)));
+        event.notes.reserve(e.noteCount);
+        for (uint32_t n = e.firstNote; n < e.firstNote + e.noteCount; n++) {
+            event.notes.push_back(Score::Note(notes[n].isNewNote != 0, notes[n].midiNumber));
+        }
+        event.duration = makeFraction(e.duration);
+        event.tempo = e.tempo;
+        event.meterNumer = e.meterNumer;
+        event.meterDenom = e.meterDenom;
+        eventList.push_back(std::move(event));
+    }
+
+    Score::TempoChangeList tempoList;
+    for (uint32_t i = 0; i < header->tempoCount; i++) {
+        const CachedTempo& t = tempos[i];
+        tempoList.push_back(Score::TempoChange(Score::MeasureInfo(t.measureNumber,
+            makeFraction(t.measurePosition), makeFraction(t.measureFraction)),
+            t.newTempo, t.noteLength));
+    }
+
+    Score::MeterChangeList meterList;
+    for (uint32_t i = 0; i < header->meterCount; i++) {
+        const CachedMeter& m = meters[i];
+        meterList.push_back(Score::MeterChange(m.measureNumber, m.numer, m.denom));
+    }
+
+    return std::make_shared<Score>(std::move(eventList), std::move(tempoList),
+                                   std::move(meterList));
+}
+
+bool ScoreCache::getTemplates(float sampleRate, int blockSize, Templates& templates) const
+{
+    if (!m_file) return false;
+
+    const CacheHeader* header = m_file->at<CacheHeader>(0, 1);
+    const CachedGeometry* geometries =
+        m_file->at<CachedGeometry>(header->geometriesOffset, header->geometryCount);
+
+    for (uint32_t i = 0; i < header->geometryCount; i++) {
+        const CachedGeometry& g = geometries[i];
+        if (g.sampleRate != sampleRate || g.blockSize != blockSize) continue;
+        const int32_t* eventTemplates =
+            m_file->at<int32_t>(g.eventTemplatesOffset, header->eventCount);
+        const double* logTemplates =
+            m_file->at<double>(g.logTemplatesOffset, uint64_t(g.templateCount) * g.stride);
+        if (!eventTemplates || !logTemplates || g.bins <= 0 || g.stride < g.bins ||
+            g.logTemplatesOffset % TEMPLATE_ALIGNMENT != 0 ||
+            (g.stride * sizeof(double)) % TEMPLATE_ALIGNMENT != 0) {
+            return false;
+        }
+        for (uint32_t event = 0; event < header->eventCount; event++) {
+            if (eventTemplates[event] < 0 || uint32_t(eventTemplates[event]) >= g.templateCount) {
+                return false;
+            }
+        }
+        templates.bins = g.bins;
+        templates.stride = g.stride;
+        templates.count = g.templateCount;
+        templates.logTemplates = logTemplates;
+        templates.eventTemplates = eventTemplates;
+        templates.storage = m_file;
+        return true;
+    }
+    return false;
+}
+
+namespace {
+
+struct CacheWriter
+{
+    std::string buffer;
+
+    uint64_t append(const void* data, size_t n) {
+        uint64_t offset = buffer.size();
+        if (n > 0) buffer.append(static_cast<const char*>(data), n);
+        return offset;
+    }
+
+    uint64_t align() {
+        buffer.resize((buffer.size() + SECTION_ALIGNMENT - 1) /
+                      SECTION_ALIGNMENT * SECTION_ALIGNMENT, '\0');
+        return buffer.size();
+    }
+
+    template <typename T>
+    uint64_t appendSection(const vector<T>& values) {
+        uint64_t offset = align();
+        append(values.data(), values.size() * sizeof(T));
+        return offset;
+    }
+};
+
+}
+
+bool ScoreCache::store(const Score& score, float sampleRate, int blockSize,
+                       const Templates* templates)
+{
+    // Gather everything to be kept before writing over the file
+    struct Geometry {
+        CachedGeometry info;
+        Templates templates;
+    };
+    vector<Geometry> geometries;
+    if (templates) {
+        Geometry current;
+        memset(&current.info, 0, sizeof(current.info));
+        current.info.sampleRate = sampleRate;
+        current.info.blockSize = blockSize;
+        current.templates = *templates;
+        geometries.push_back(current);
+    }
+
+    if (m_file) {
+        const CacheHeader* header = m_file->at<CacheHeader>(0, 1);
+        const CachedGeometry* cached =
+            m_file->at<CachedGeometry>(header->geometriesOffset, header->geometryCount);
+        for (uint32_t i = 0; i < header->geometryCount; i++) {
+            if (templates && cached[i].sampleRate == sampleRate &&
+                cached[i].blockSize == blockSize) {
+                continue;
+            }
+            Geometry other;
+            other.info = cached[i];
+            if (getTemplates(cached[i].sampleRate, cached[i].blockSize, other.templates)) {
+                geometries.push_back(other);
+            }
+        }
+    }
+
+    vector<CachedEvent> events;
+    vector<CachedNote> notes;
+    for (const auto& event : score.getMusicalEvents()) {
+        CachedEvent e;
+        e.measureNumber = event.measureInfo.measureNumber;
+        storeFraction(event.measureInfo.measurePosition, e.measurePosition);
+        storeFraction(event.measureInfo.measureFraction, e.measureFraction);
+        storeFraction(event.duration, e.duration);
+        e.tempo = event.tempo;
+        e.meterNumer = event.meterNumer;
+        e.meterDenom = event.meterDenom;
+        e.firstNote = notes.size();
+        e.noteCount = event.notes.size();
+        for (const auto& note : event.notes) {
+            notes.push_back({ note.isNewNote ? 1 : 0, note.midiNumber });
+        }
+        events.push_back(e);
+    }
+
+    vector<CachedTempo> tempos;
+    for (const auto& change : score.getTempoChanges()) {
+        CachedTempo t;
+        t.measureNumber = change.measureInfo.measureNumber;
+        storeFraction(change.measureInfo.measurePosition, t.measurePosition);
+        storeFraction(change.measureInfo.measureFraction, t.measureFraction);
+        t.newTempo = change.newTempo;
+        t.noteLength = change.noteLength;
+        tempos.push_back(t);
+    }
+
+    vector<CachedMeter> meters;
+    for (const auto& change : score.getMeterChanges()) {
+        meters.push_back({ change.measureNumber, change.numer, change.denom });
+    }
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.endianTag = ENDIAN_TAG;
+    header.sourceHash = getSourceHash();
+    for (int source = 0; source < SOURCE_COUNT; source++) {
+        header.sourceTimes[source] = getModificationTime(getSourcePath(source));
+        header.sourceSizes[source] = getFileSize(getSourcePath(source));
+    }
+    header.eventCount = events.size();
+    header.noteCount = notes.size();
+    header.tempoCount = tempos.size();
+    header.meterCount = meters.size();
+    header.geometryCount = geometries.size();
+
+    CacheWriter writer;
+    writer.append(&header, sizeof(header));
+    header.eventsOffset = writer.appendSection(events);
+    header.notesOffset = writer.appendSection(notes);
+    header.temposOffset = writer.appendSection(tempos);
+    header.metersOffset = writer.appendSection(meters);
+    for (auto& g : geometries) {
+        g.info.bins = g.templates.bins;
+        g.info.stride = g.templates.stride;
+        g.info.templateCount = g.templates.count;
+        g.info.eventTemplatesOffset = writer.align();
+        writer.append(g.templates.eventTemplates, events.size() * sizeof(int32_t));
+        g.info.logTemplatesOffset = writer.align();
+        writer.append(g.templates.logTemplates,
+                      size_t(g.templates.count) * g.templates.stride * sizeof(double));
+    }
+    header.geometriesOffset = writer.align();
+    for (const auto& g : geometries) {
+        writer.append(&g.info, sizeof(g.info));
+    }
+    memcpy(&writer.buffer[0], &header, sizeof(header));
+
+    // Write to a temporary file and rename it into place, so that
+    // nobody ever maps a half-written cache
+    path cachePath = getCachePath();
+    path tempPath = cachePath;
+    tempPath += "." + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out || !out.write(writer.buffer.data(), writer.buffer.size())) {
+            LOG_WARNING("ScoreCache: unable to write cache " << tempPath);
+            std::error_code ec;
+            std::filesystem::remove(tempPath, ec);
+            return false;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(tempPath, cachePath, ec);
+    if (ec) {
+        LOG_WARNING("ScoreCache: unable to replace cache " << cachePath
+                    << ": " << ec.message());
+        std::filesystem::remove(tempPath, ec);
+        return false;
+    }
+    return true;
+}
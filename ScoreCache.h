@@ -0,0 +1,83 @@
+/*
+  A compiled binary form of a score, stored next to its .solo file and
+  memory-mapped when loaded, so that neither the text files nor (once
+  they have been built in full) the event templates need to be
+  processed again.
+*/
+
+#ifndef SCORE_CACHE_H
+#define SCORE_CACHE_H
+
+#include "Score.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+
+using std::shared_ptr;
+using std::string;
+
+class MappedFile;
+
+class ScoreCache
+{
+public:
+    // Each template row starts on a boundary of this many bytes
+    static const int TEMPLATE_ALIGNMENT = 64;
+
+    // The version of the cache layout, the score parser and the
+    // template generation, which anything kept elsewhere that was
+    // derived from the templates should also depend on
+    static uint32_t getVersion();
+
+    // Log-templates for one feature geometry. Events with the same
+    // notes share a template, so there may be fewer than events.
+    struct Templates
+    {
+        int bins;
+        int stride; // bins, padded to TEMPLATE_ALIGNMENT
+        int count;
+        const double* logTemplates; // count rows of stride values
+        const int32_t* eventTemplates; // template row for each event
+        shared_ptr<const void> storage; // owns what the above point to
+
+        Templates() : bins{0}, stride{0}, count{0}, logTemplates{nullptr},
+         eventTemplates{nullptr} { }
+    };
+
+    // Map the cache for the named score in the given directory, if
+    // there is one and it is still current with the score's source
+    // files (same modification times and sizes, or failing that the
+    // same content hash).
+    ScoreCache(std::filesystem::path scoreDir, string scoreName);
+    ~ScoreCache();
+
+    bool isCurrent() const;
+
+    // The cached score, or nullptr if the cache is not current
+    shared_ptr<const Score> getScore() const;
+
+    // The cached templates for this geometry, if the cache is current
+    // and has them
+    bool getTemplates(float sampleRate, int blockSize, Templates& templates) const;
+
+    // Write the cache for this score and geometry, keeping any other
+    // geometries already in a current cache. With no templates only
+    // the score and those other geometries are written. Returns false
+    // if the cache could not be written, which is not otherwise an
+    // error.
+    bool store(const Score& score, float sampleRate, int blockSize,
+               const Templates* templates);
+
+private:
+    std::filesystem::path m_dir;
+    string m_name;
+    shared_ptr<MappedFile> m_file; // null unless current
+
+    std::filesystem::path getCachePath() const;
+    std::filesystem::path getSourcePath(int source) const;
+    uint64_t getSourceHash() const;
+};
+
+#endif
@@ -0,0 +1,295 @@
+
+#include "ScoreLibrary.h"
+#include "Log.h"
+#include "Paths.h"
+
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+using std::vector;
+using std::filesystem::path;
+using std::filesystem::directory_iterator;
+using std::string;
+using std::map;
+
+// Refreshes requested within this long of the last one reuse its result
+static const std::chrono::seconds REFRESH_INTERVAL(2);
+
+static const char* INDEX_HEADER = "piano-aligner score library 1";
+
+namespace {
+
+struct Candidate
+{
+    int64_t modified; // of the candidate folder itself
+    bool valid;
+};
+
+struct Directory
+{
+    int64_t modified;
+    map<string, Candidate> candidates; // by name
+};
+
+struct Library
+{
+    std::mutex mutex;
+    bool indexRead = false;
+    bool refreshed = false;
+    std::chrono::steady_clock::time_point lastRefresh;
+    vector<path> dirs; // as at the last refresh
+    map<string, Directory> index; // by score directory
+    map<string, path> scores;
+};
+
+Library& getLibrary()
+{
+    static Library library;
+    return library;
+}
+
+}
+
+static int64_t getModificationTime(const path& p)
+{
+    std::error_code ec;
+    auto time = std::filesystem::last_write_time(p, ec);
+    if (ec) return 0;
+    return time.time_since_epoch().count();
+}
+
+static bool isValidScore(const path& candidate, const string& name)
+{
+    std::error_code ec;
+    path scoreFile(candidate.string() + "/" + name + ".solo");
+    if (!exists(scoreFile, ec)) {
+        LOG_WARNING("WARNING: Candidate score folder "
+                    << candidate << " lacks " << name << ".solo file");
+        return false;
+    }
+
+    path tempoFile(candidate.string() + "/" + name + ".tempo");
+    if (!exists(tempoFile, ec)) {
+        LOG_WARNING("WARNING: Candidate score folder "
+                    << candidate << " lacks " << name << ".tempo file");
+        return false;
+    }
+
+    return true;
+}
+
+path
+ScoreLibrary::getIndexPath()
+{
+    path dir = Paths::getCacheDirectory();
+    if (dir.empty()) return {};
+    return dir / "score-library";
+}
+
+// The index file has a header line, then for each score directory a
+// line "D <tab> modified <tab> directory" followed by a line
+// "S <tab> modified <tab> valid <tab> name" for each of its candidates.
+
+static void readIndex(map<string, Directory>& index)
+try {
+    path indexPath = ScoreLibrary::getIndexPath();
+    if (indexPath.empty()) return;
+    std::ifstream in(indexPath);
+    string line;
+    if (!in || !std::getline(in, line) || line != INDEX_HEADER) return;
+
+    Directory* current = nullptr;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        string kind, modified;
+        if (!std::getline(fields, kind, '\t') ||
+            !std::getline(fields, modified, '\t')) {
+            break;
+        }
+        if (kind == "D") {
+            string dir;
+            std::getline(fields, dir);
+            current = &index[dir];
+            current->modified = std::stoll(modified);
+        } else if (kind == "S" && current) {
+            string valid, name;
+            if (!std::getline(fields, valid, '\t') || !std::getline(fields, name)) {
+                break;
+            }
+            current->candidates[name] = { std::stoll(modified), valid == "1" };
+        } else {
+            break;
+        }
+    }
+} catch (const std::exception&) {
+    // An unreadable index is simply rebuilt
+    index.clear();
+}
+
+static void writeIndex(const map<string, Directory>& index)
+{
+    path indexPath = ScoreLibrary::getIndexPath();
+    if (indexPath.empty()) return;
+    std::error_code ec;
+    std::filesystem::create_directories(indexPath.parent_path(), ec);
+
+    // Write to a temporary file and rename it into place, so that
+    // another process never reads a half-written index
+    path tempPath = indexPath;
+    tempPath += "." + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+    {
+        std::ofstream out(tempPath, std::ios::trunc);
+        if (!out) return;
+        out << INDEX_HEADER << '\n';
+        for (const auto& dir : index) {
+            out << "D\t" << dir.second.modified << '\t' << dir.first << '\n';
+            for (const auto& candidate : dir.second.candidates) {
+                out << "S\t" << candidate.second.modified << '\t'
+                    << (candidate.second.valid ? 1 : 0) << '\t'
+                    << candidate.first << '\n';
+            }
+        }
+        if (!out) {
+            out.close();
+            std::filesystem::remove(tempPath, ec);
+            return;
+        }
+    }
+    std::filesystem::rename(tempPath, indexPath, ec);
+    if (ec) std::filesystem::remove(tempPath, ec);
+}
+
+// Bring the index entry for one score directory up to date, returning
+// true if it changed
+static bool refreshDirectory(const path& dir, Directory& entry, bool known)
+{
+    int64_t modified = getModificationTime(dir);
+    bool changed = false;
+
+    if (known && modified == entry.modified) {
+        // Nothing has been added or removed, but a folder may have had
+        // its files added, removed or renamed since
+        for (auto& candidate : entry.candidates) {
+            path folder = dir / candidate.first;
+            int64_t folderModified = getModificationTime(folder);
+            if (folderModified == candidate.second.modified) continue;
+            candidate.second = { folderModified, isValidScore(folder, candidate.first) };
+            changed = true;
+        }
+        return changed;
+    }
+
+    map<string, Candidate> candidates;
+    std::error_code ec;
+    for (directory_iterator itr(dir, ec), end; !ec && itr != end; itr.increment(ec)) {
+
+        path candidate = itr->path();
+        string name(candidate.filename().string());
+        if (name.size() == 0 || name[0] == '.' ||
+            name.find_first_of("\t\n") != string::npos) {
+            continue;
+        }
+        std::error_code typeError;
+        if (!itr->is_directory(typeError)) continue;
+
+        int64_t folderModified = getModificationTime(candidate);
+        auto previous = entry.candidates.find(name);
+        if (known && previous != entry.candidates.end() &&
+            previous->second.modified == folderModified) {
+            candidates[name] = previous->second;
+        } else {
+            candidates[name] = { folderModified, isValidScore(candidate, name) };
+        }
+    }
+
+    entry.modified = modified;
+    entry.candidates = candidates;
+    return true;
+}
+
+static void refresh(Library& library, const vector<path>& dirs)
+{
+    if (!library.indexRead) {
+        readIndex(library.index);
+        library.indexRead = true;
+    }
+
+    bool changed = false;
+    int dirsThatExist = 0;
+    map<string, path> scores;
+
+    for (auto dir : dirs) {
+
+        std::error_code ec;
+        if (!exists(dir, ec)) continue;
+        ++dirsThatExist;
+
+        string key = dir.string();
+        bool known = library.index.find(key) != library.index.end();
+        Directory& entry = library.index[key];
+        if (refreshDirectory(dir, entry, known)) changed = true;
+
+        for (const auto& candidate : entry.candidates) {
+            if (!candidate.second.valid ||
+                scores.find(candidate.first) != scores.end()) {
+                continue;
+            }
+            scores[candidate.first] = dir / candidate.first;
+        }
+    }
+
+    if (dirsThatExist == 0 && (!library.refreshed || dirs != library.dirs)) {
+        LOG_WARNING("WARNING: None of the specified score folders exists!");
+        LOG_WARNING("Folders are:");
+        for (auto dir : dirs) {
+            LOG_WARNING(dir);
+        }
+    }
+
+    for (const auto& score : scores) {
+        auto previous = library.scores.find(score.first);
+        if (previous == library.scores.end() || previous->second != score.second) {
+            LOG_DEBUG("Found valid-looking score folder: " << score.second);
+        }
+    }
+
+    if (changed) writeIndex(library.index);
+
+    library.scores = scores;
+    library.dirs = dirs;
+    library.refreshed = true;
+    library.lastRefresh = std::chrono::steady_clock::now();
+}
+
+map<string, path>
+ScoreLibrary::getScores()
+{
+    Library& library = getLibrary();
+    auto dirs = Paths::getScoreDirectories();
+    std::lock_guard<std::mutex> guard(library.mutex);
+    if (!library.refreshed || dirs != library.dirs ||
+        std::chrono::steady_clock::now() - library.lastRefresh >= REFRESH_INTERVAL) {
+        refresh(library, dirs);
+    }
+    return library.scores;
+}
+
+bool
+ScoreLibrary::findScore(string name, path& folder)
+{
+    Library& library = getLibrary();
+    auto dirs = Paths::getScoreDirectories();
+    std::lock_guard<std::mutex> guard(library.mutex);
+    if (!library.refreshed || dirs != library.dirs ||
+        std::chrono::steady_clock::now() - library.lastRefresh >= REFRESH_INTERVAL ||
+        library.scores.find(name) == library.scores.end()) {
+        refresh(library, dirs);
+    }
+    auto itr = library.scores.find(name);
+    if (itr == library.scores.end()) return false;
+    folder = itr->second;
+    return true;
+}
@@ -0,0 +1,44 @@
+#ifndef PIANO_ALIGNER_SCORE_LIBRARY_H
+#define PIANO_ALIGNER_SCORE_LIBRARY_H
+
+#include <filesystem>
+#include <map>
+#include <string>
+
+/**
+ * The process-wide index of the scores in the score directories (see
+ * Paths::getScoreDirectories), shared by every plugin instance.
+ *
+ * The index is kept in a file in the user's cache directory between
+ * runs, and refreshed incrementally: a score directory is only listed
+ * again when its modification time has changed, and a candidate score
+ * folder is only examined again when it is new or its own modification
+ * time has changed. A host enumerating programs at startup therefore
+ * costs one stat per score directory and one per score folder once the
+ * index exists, without reading any of the folders.
+ */
+class ScoreLibrary
+{
+public:
+    /**
+     * Return the scores in the score directories, as a map from score
+     * name to score folder, as for Paths::getScores. Calls within a
+     * short interval of one another share a single refresh.
+     */
+    static std::map<std::string, std::filesystem::path> getScores();
+
+    /**
+     * Find the folder of the named score. If it is not in the index,
+     * refresh the index regardless of the interval and look again, so
+     * that a score added a moment ago can be loaded.
+     */
+    static bool findScore(std::string name, std::filesystem::path& folder);
+
+    /**
+     * Return the file in which the index is kept between runs, or an
+     * empty path if there is nowhere suitable.
+     */
+    static std::filesystem::path getIndexPath();
+};
+
+#endif
@@ -0,0 +1,194 @@
+/*
+  Everything needed to align against a score that does not depend on
+  the audio, loaded once and then shared read-only between aligners.
+*/
+
+#include "ScoreModel.h"
+#include "ScoreCache.h"
+#include "Log.h"
+#include "Templates.h"
+#include "ScoreLibrary.h"
+
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+
+
+ScoreModel::ScoreModel(float sampleRate, int hopSize, int blockSize) :
+    m_sampleRate{sampleRate}, m_hopSize{hopSize}, m_blockSize{blockSize},
+    m_scoreParsed{false}, m_score{std::make_shared<Score>()},
+    m_loadSeconds{0.}, m_graph{std::make_shared<CompiledGraph>()}
+{
+}
+
+ScoreModel::~ScoreModel()
+{
+}
+
+bool ScoreModel::load(string scoreName)
+{
+    LOG_DEBUG("In ScoreModel::load: scoreName is -> " << scoreName);
+    auto start = std::chrono::steady_clock::now();
+
+    std::filesystem::path targetPath;
+    if (!ScoreLibrary::findScore(scoreName, targetPath)) {
+        LOG_ERROR("Score not found: " << scoreName);
+        return false;
+    }
+
+    // The score library has already verified that these exist
+    std::string scorePath = targetPath.string() + "/" + scoreName + ".solo";
+    std::string scoreTempoPath = targetPath.string() + "/" + scoreName + ".tempo";
+    std::string scoreMeterPath = targetPath.string() + "/" + scoreName + ".meter";
+
+    // Use the compiled cache if it is current, and bring it up to
+    // date if not
+    m_scoreDir = targetPath;
+    m_scoreName = scoreName;
+    ScoreCache cache(targetPath, scoreName);
+    bool success = true;
+    shared_ptr<const Score> score = cache.getScore();
+    if (!score) {
+        auto parsed = std::make_shared<Score>();
+        success = parsed->initialize(scorePath);
+        if (success)    success = parsed->readTempo(scoreTempoPath);
+        if (success)    success = parsed->readMeter(scoreMeterPath);
+        if (success)    cache.store(*parsed, m_sampleRate, m_blockSize, nullptr);
+        score = parsed;
+    }
+    m_score = score;
+    m_scoreParsed = success;
+
+    // Log-templates, so that likelihoods need no log() per bin
+    ScoreCache::Templates templates;
+    if (cache.getTemplates(m_sampleRate, m_blockSize, templates)) {
+        m_templates = std::make_shared<EventTemplates>(templates, m_sampleRate, m_blockSize);
+    } else {
+        m_templates = std::make_shared<EventTemplates>(*m_score, m_sampleRate, m_blockSize);
+    }
+    m_precomputed = std::make_shared<std::once_flag>();
+    int bins = m_templates->getBinCount();
+
+    Template silenceTemplate; // TODO: Change it later.
+    double low_freq = 20.;
+    double low_proportion = .5;
+    double p1 = low_proportion / low_freq;
+    double p2 = (1 - low_proportion) / (double)bins;
+    for (int bin = 0; bin < bins; bin++) {
+        if (bin < low_freq) {
+            silenceTemplate.push_back(p1 + p2);
+        } else {
+            silenceTemplate.push_back(p2);
+        }
+    }
+    auto silenceLogTemplate = std::make_shared<vector<double>>();
+    for (const auto& value : silenceTemplate) {
+        silenceLogTemplate->push_back(log(value));
+    }
+    m_silenceLogTemplate = silenceLogTemplate;
+    m_graph = std::make_shared<CompiledGraph>(); // for the new score
+
+    m_loadSeconds = std::chrono::duration<double>
+        (std::chrono::steady_clock::now() - start).count();
+    return success;
+}
+
+void ScoreModel::precomputeTemplates(ThreadPool::Priority priority) const
+{
+    if (!m_templates) return; // not loaded
+    std::call_once(*m_precomputed, [this, priority]() {
+        if (m_templates->isComplete()) return; // e.g. from the cache
+        m_templates->buildAll(priority);
+        if (m_scoreParsed) {
+            ScoreCache::Templates templates = m_templates->getAll();
+            ScoreCache(m_scoreDir, m_scoreName).store(*m_score, m_sampleRate, m_blockSize,
+                                                      &templates);
+        }
+    });
+}
+
+// Only a full-range alignment uses the compiled graph, so one of part
+// of a long score doesn't pay for it
+void ScoreModel::compileStateGraph() const
+{
+    std::call_once(m_graph->once, [this]() {
+        auto start = std::chrono::steady_clock::now();
+        int events = m_score->getMusicalEvents().size();
+        m_graph->graph = SimpleHMM::buildStateGraph(*m_score, m_sampleRate, m_hopSize,
+            SimpleHMM::Segment(0, events, 0, 0, SimpleHMM::Free, SimpleHMM::Free));
+        m_graph->seconds = std::chrono::duration<double>
+            (std::chrono::steady_clock::now() - start).count();
+    });
+}
+
+shared_ptr<const ScoreModel> ScoreModel::withHopSize(int hopSize) const
+{
+    auto model = std::make_shared<ScoreModel>(*this);
+    model->m_hopSize = hopSize;
+    model->m_graph = std::make_shared<CompiledGraph>(); // for the new hop size
+    return model;
+}
+
+float ScoreModel::getSampleRate() const
+{
+    return m_sampleRate;
+}
+
+int ScoreModel::getHopSize() const
+{
+    return m_hopSize;
+}
+
+int ScoreModel::getBinCount() const
+{
+    return m_templates ? m_templates->getBinCount() : 0;
+}
+
+const Score& ScoreModel::getScore() const
+{
+    return *m_score;
+}
+
+const double* ScoreModel::getLogTemplate(int event) const
+{
+    return m_templates->getLogTemplate(event);
+}
+
+const double* ScoreModel::getBaselineLogTemplate() const
+{
+    return m_templates->getBaselineLogTemplate();
+}
+
+const EventTemplates::SparseLogTemplate& ScoreModel::getSparseLogTemplate(int event) const
+{
+    return m_templates->getSparseLogTemplate(event);
+}
+
+const double* ScoreModel::getSilenceLogTemplate() const
+{
+    return m_silenceLogTemplate->data();
+}
+
+shared_ptr<const SimpleHMM::StateGraph>
+ScoreModel::getStateGraph(const SimpleHMM::Segment& segment) const
+{
+    if (m_templates && segment.startEvent == 0 &&
+        segment.endEvent == int(m_score->getMusicalEvents().size()) &&
+        segment.start == SimpleHMM::Free && segment.end == SimpleHMM::Free) {
+        compileStateGraph();
+        return m_graph->graph;
+    }
+    return nullptr;
+}
+
+AlignmentStats::Values ScoreModel::getStatistics() const
+{
+    AlignmentStats::Values values;
+    values.push_back({ "model.loadSeconds", m_loadSeconds });
+    values.push_back({ "model.graphSeconds", m_graph->seconds.load() }); // 0 until compiled
+    values.push_back({ "templates.count", double(m_templates ? m_templates->getTemplateCount() : 0) });
+    values.push_back({ "templates.built", double(m_templates ? m_templates->getBuiltCount() : 0) });
+    values.push_back({ "templates.buildSeconds", m_templates ? m_templates->getBuildSeconds() : 0. });
+    values.push_back({ "templates.fromCache", double(m_templates && m_templates->isComplete()) });
+    return values;
+}
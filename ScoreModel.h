@@ -0,0 +1,97 @@
+/*
+  Everything needed to align against a score that does not depend on
+  the audio, loaded once and then shared read-only between aligners.
+*/
+
+#ifndef SCORE_MODEL_H
+#define SCORE_MODEL_H
+
+#include "AlignmentStats.h"
+#include "EventTemplates.h"
+#include "Score.h"
+#include "SimpleHMM.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+
+class ScoreModel
+{
+public:
+    ScoreModel(float sampleRate, int hopSize, int blockSize);
+    ~ScoreModel();
+
+    // Load the named score from the score path. The score, and its
+    // templates if they have been built in full before, come from its
+    // compiled cache when that is current, see ScoreCache; otherwise
+    // templates are built as events are first asked for.
+    bool load(string scoreName);
+
+    // Build every event template now, in parallel, and keep them in
+    // the score cache for next time. Worthwhile before aligning the
+    // whole score, or many performances of it.
+    void precomputeTemplates(ThreadPool::Priority priority = ThreadPool::Normal) const;
+
+    // A model sharing this one's score and templates but with a
+    // different hop size, and so a different state graph.
+    shared_ptr<const ScoreModel> withHopSize(int hopSize) const;
+
+    float getSampleRate() const;
+    int getHopSize() const;
+    int getBinCount() const;
+    const Score& getScore() const;
+
+    // The log of an event's template, getBinCount() values starting
+    // on a 64-byte boundary, built if it has not been already
+    const double* getLogTemplate(int event) const;
+    const double* getSilenceLogTemplate() const;
+
+    // The same log-templates as a shared baseline plus a sparse
+    // correction for each event, see EventTemplates
+    const double* getBaselineLogTemplate() const;
+    const EventTemplates::SparseLogTemplate& getSparseLogTemplate(int event) const;
+
+    // The state graph for the segment, if it spans the whole score, in
+    // which case it is compiled on the first request and then shared;
+    // otherwise nullptr and the caller builds its own.
+    shared_ptr<const SimpleHMM::StateGraph> getStateGraph(const SimpleHMM::Segment& segment) const;
+
+    // Time spent loading and compiling the model, and how many of its
+    // templates have been built (by any aligner) and in how long
+    AlignmentStats::Values getStatistics() const;
+
+private:
+    float m_sampleRate;
+    int m_hopSize;
+    int m_blockSize;
+    std::filesystem::path m_scoreDir;
+    string m_scoreName;
+    bool m_scoreParsed; // read without error, so fit to be cached
+    shared_ptr<const Score> m_score;
+    shared_ptr<const EventTemplates> m_templates;
+    shared_ptr<std::once_flag> m_precomputed; // shared with m_templates
+    shared_ptr<const vector<double>> m_silenceLogTemplate;
+    double m_loadSeconds;
+
+    // The state graph for all events, compiled when first asked for
+    struct CompiledGraph {
+        std::once_flag once;
+        shared_ptr<const SimpleHMM::StateGraph> graph;
+        std::atomic<double> seconds{0.};
+    };
+    shared_ptr<CompiledGraph> m_graph;
+
+    void compileStateGraph() const;
+};
+
+#endif
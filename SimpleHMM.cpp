@@ -3,8 +3,12 @@
 */
 
 #include "SimpleHMM.h"
+#include "Lattice.h"
+#include "Log.h"
+#include "ScoreModel.h"
 
 #include <cmath>
+#include <limits>
 #include <map>
 #include <algorithm>
 
@@ -13,81 +17,163 @@ static const int BEAM_SEARCH_WIDTH = 200;
 using Hypothesis = SimpleHMM::Hypothesis;
 using State = SimpleHMM::State;
 
-SimpleHMM::SimpleHMM(AudioToScoreAligner& aligner) : m_aligner{aligner}
+SimpleHMM::SimpleHMM(AudioToScoreAligner& aligner) :
+    SimpleHMM(aligner, Segment(aligner.getStartEvent(), aligner.getEndEvent(),
+                               0, aligner.getFrameCount(), Free, Free))
 {
-    // Build the state graph: m_nextStates and m_prevStates.
-    Score score = m_aligner.getScore();
-    Score::MusicalEventList events = score.getMusicalEvents();
-    float sr = m_aligner.getSampleRate();
-    int hopSize = m_aligner.getHopSize();
+}
+
+SimpleHMM::SimpleHMM(AudioToScoreAligner& aligner, const Segment& segment) :
+    m_aligner{aligner}, m_segment{segment}, m_beamWidth{BEAM_SEARCH_WIDTH}
+{
+    // Use the score model's compiled state graph if it has one for this
+    // segment, otherwise build one
+    if (m_aligner.getModel()) {
+        m_graph = m_aligner.getModel()->getStateGraph(segment);
+    }
+    if (!m_graph) {
+        AlignmentStats::Timer timer(m_aligner.getStats(), AlignmentStats::GraphConstruction);
+        m_aligner.getStats().count(AlignmentStats::GraphsBuilt);
+        m_graph = buildStateGraph(m_aligner.getScore(), m_aligner.getSampleRate(),
+                                  m_aligner.getHopSize(), segment);
+    }
+}
+
+// The nominal length of an event in frames, from its duration and tempo
+static double getNominalFrames(const Score::EventArrays& events, int eventIndex,
+                               float sr, int hopSize)
+{
+    float tempo = events.tempo[eventIndex];
+    if (tempo == 0.0) {
+        LOG_WARNING("In SimpleHMM: event.tempo is zero!!!");
+    }
+    double secs = events.duration[eventIndex] * 4 * 60. / tempo; // tempo is defined in quarter note
+    return secs * sr / (double)hopSize;
+}
+
+std::shared_ptr<const SimpleHMM::StateGraph>
+SimpleHMM::buildStateGraph(const Score& score, float sr, int hopSize,
+                           const Segment& segment)
+{
+    // Build the state graph: nextStates and prevStates.
+    auto graph = std::make_shared<StateGraph>();
+    auto& nextStates = graph->nextStates;
+    auto& prevStates = graph->prevStates;
+    auto& firstStates = graph->firstStates;
+    auto& lastStates = graph->lastStates;
+    Score::EventArrays events = score.getEventArrays();
     if (hopSize == 0) {
-        std::cerr << "hopSize = 0 in SimpleHMM()." << '\n';
-        return;
+        LOG_ERROR("hopSize = 0 in SimpleHMM().");
+        return graph;
     }
 
-    // specify the starting state
+    // specify the starting state, unless the segment starts with an
+    // anchored onset or part way through an event, in which case it
+    // starts in the first event
     double p = 0.975; // self-loop
     double tailProb  = 1 - p; // leaving the micro state
-    State startingState = State(-1, 0);
-    m_nextStates[startingState][startingState] = p;
-    m_prevStates[startingState][startingState] = p;
-    State tail = startingState;
+    State tail = State(-1, 0);
+    bool haveTail = false;
+    if (segment.start == Free) {
+        State startingState = State(-1, 0);
+        nextStates[startingState][startingState] = p;
+        prevStates[startingState][startingState] = p;
+        firstStates.push_back(startingState);
+        haveTail = true;
+    }
     //std::cout << "tail:" << State::toString(*tail) << '\n';
 
 
-    // add micro states for each event
-    int eventIndex = 0;
-    for (auto& event : events) {
-        if (event.tempo == 0.0) {
-            std::cerr << "In SimpleHMM: event.tempo is zero!!!" << '\n';
+    // add micro states for each event in the segment, except that a
+    // run of consecutive events each shorter than a frame (grace notes,
+    // arpeggios, fast runs) is merged into composite events of about a
+    // frame each, with the states of an event of that length
+    for (int eventIndex = segment.startEvent;
+         eventIndex < segment.endEvent; ) {
+        int endIndex = eventIndex + 1;
+        double frames = getNominalFrames(events, eventIndex, sr, hopSize);
+        if (frames < 1.) {
+            while (frames < 1. && endIndex < segment.endEvent) {
+                double next = getNominalFrames(events, endIndex, sr, hopSize);
+                if (!(next < 1.)) break;
+                frames += next;
+                endIndex++;
+            }
+            if (endIndex > eventIndex + 1) {
+                graph->composites[eventIndex] = endIndex;
+            }
         }
-        double secs = event.duration.getValue() * 4 * 60. / event.tempo; // tempo is defined in quarter note
-        double frames = secs * sr / (double)hopSize;
         double var = (0.25*0.25) * frames * frames;
         int M = round(frames*frames / (var + frames));
+        // Short events, as are common at a coarse resolution, must not
+        // have more micro states than frames or p would be negative
+        if (M > frames) M = floor(frames);
         if (M < 1)  M = 1;
         p = 1. - M / frames; // frames shouldn't be 0
+        if (p < 0.) p = 0.; // event shorter than one frame
         //std::cout << "frames = "<<frames<<", var="<<var<<", M = " << M <<", p="<<p << '\n';
         for (int m = 0; m < M; m++) {
             // add a state
             State newState = State(eventIndex, m);
-            m_nextStates[newState][newState] = p; // self-loop
-            m_prevStates[newState][newState] = p; // self-loop
+            nextStates[newState][newState] = p; // self-loop
+            prevStates[newState][newState] = p; // self-loop
             if (m == 0) {
-                m_nextStates[tail][newState] = tailProb;
-                m_prevStates[newState][tail] = tailProb;
+                if (haveTail) {
+                    nextStates[tail][newState] = tailProb;
+                    prevStates[newState][tail] = tailProb;
+                }
             } else {
-                m_nextStates[tail][newState] = 1-p; // leave state
-                m_prevStates[newState][tail]  = 1-p;
+                nextStates[tail][newState] = 1-p; // leave state
+                prevStates[newState][tail]  = 1-p;
+            }
+            if (eventIndex == segment.startEvent &&
+                ((segment.start == Onset && m == 0) || segment.start == Within)) {
+                firstStates.push_back(newState);
+            }
+            if (endIndex == segment.endEvent && segment.end == Within) {
+                lastStates.push_back(newState);
             }
             tail = newState;
+            haveTail = true;
         }
         tailProb = 1 - p;
-        eventIndex++;
+        eventIndex = endIndex;
+    }
+    if (!graph->composites.empty()) {
+        LOG_DEBUG("SimpleHMM: merged " << graph->composites.size()
+                  << " run(s) of events shorter than a frame");
     }
 
-    // add the ending state
-    State lastState = State(-2, 0);
-    m_nextStates[lastState][lastState] = 1.;
-    m_prevStates[lastState][lastState] = 1.;
-    m_nextStates[tail][lastState] = tailProb;
-    m_prevStates[lastState][tail] = tailProb;
+    // add the ending state, unless the next event's onset is anchored
+    // just after the segment, in which case it ends in the last micro
+    // state of the last event, or the segment ends part way through
+    // the last event
+    if (segment.end == Free) {
+        State lastState = State(-2, 0);
+        nextStates[lastState][lastState] = 1.;
+        prevStates[lastState][lastState] = 1.;
+        nextStates[tail][lastState] = tailProb;
+        prevStates[lastState][tail] = tailProb;
+        lastStates.push_back(lastState);
+    } else if (segment.end == Onset) {
+        lastStates.push_back(tail);
+    }
 
 
     // test:
     /*
     State current = startingState;
-    while (m_nextStates[startingState].size() > 0) {
+    while (nextStates[startingState].size() > 0) {
         std::cout << "event/microIndex= " << current.eventIndex <<"/"<< current.microIndex<< '\n';
-        for (auto& p : m_nextStates[current]) {
+        for (auto& p : nextStates[current]) {
             std::cout << State::toString(p.first) << "\t"<<p.second<< '\n';
         }
         std::cout << "Prev:" << '\n';
-        for (auto& p : m_prevStates[current]) {
+        for (auto& p : prevStates[current]) {
             std::cout << State::toString(p.first) << "\t"<<p.second<< '\n';
         }
-        if (m_nextStates[current].size() < 2) break;
-        for (auto& q: m_nextStates[current]) {
+        if (nextStates[current].size() < 2) break;
+        for (auto& q: nextStates[current]) {
             if (!(q.first == current)) {
                 current = q.first;
                 break;
@@ -96,12 +182,19 @@ SimpleHMM::SimpleHMM(AudioToScoreAligner& aligner) : m_aligner{aligner}
 
     }
 */
+
+    return graph;
 }
 
 SimpleHMM::~SimpleHMM()
 {
 }
 
+void SimpleHMM::setBeamWidth(int width)
+{
+    m_beamWidth = width;
+}
+
 /*
 const map<State, map<State, double>>& SimpleHMM::getNextStates() const
 {
@@ -114,27 +207,129 @@ const map<State, map<State, double>>& SimpleHMM::getPrevStates() const
 }
 */
 
-static void getForwardProbs(vector<vector<Hypothesis>>* forward,
-    AudioToScoreAligner& aligner, const map<State, map<State, double>>& nextStates) {
+// Whether state may be occupied at (absolute) frame, given a corridor
+// of allowed events in which the silent states before and after the
+// segment stand for the events either side of it. A composite event
+// may be occupied if any of its events may.
+static bool isInCorridor(const AudioToScoreAligner::Corridor& corridor,
+    const SimpleHMM::StateGraph& graph, const SimpleHMM::Segment& segment,
+    int frame, const State& state) {
+
+        if (corridor.empty()) return true;
+        int event = state.eventIndex;
+        int last = event;
+        if (event == -1) event = last = segment.startEvent - 1;
+        else if (event == -2) event = last = segment.endEvent;
+        else if (!graph.composites.empty()) {
+            auto itr = graph.composites.find(event);
+            if (itr != graph.composites.end()) last = itr->second - 1;
+        }
+        return last >= corridor[frame].first && event <= corridor[frame].second;
+}
 
-        int totalFrames = aligner.getDataFeatures().size();
-        forward->reserve(totalFrames);
-        vector<Hypothesis> hypotheses;
+// The likelihood of a state's event at (absolute) frame. A composite
+// event is scored as a mixture of its events, i.e. by the mean of
+// their likelihoods, each as cached by the aligner.
+static double getStateLikelihood(AudioToScoreAligner& aligner,
+    const SimpleHMM::StateGraph& graph, int frame, int event) {
+
+        if (!graph.composites.empty()) {
+            auto itr = graph.composites.find(event);
+            if (itr != graph.composites.end()) {
+                double sum = 0.;
+                for (int e = event; e < itr->second; e++) {
+                    sum += aligner.getLikelihood(frame, e);
+                }
+                return sum / (itr->second - event);
+            }
+        }
+        return aligner.getLikelihood(frame, event);
+}
+
+// The beam in one pass, gathered locally and then added to the
+// aligner's statistics all at once
+struct BeamStats {
+    AlignmentStats& stats;
+    int64_t frames = 0;
+    int64_t hypotheses = 0;
+    int64_t maxHypotheses = 0;
+    double pruned = 0.;
+    double maxPruned = 0.;
+
+    BeamStats(AlignmentStats& s) : stats(s) { }
+    ~BeamStats() {
+        stats.addBeam(frames, hypotheses, maxHypotheses, pruned, maxPruned);
+    }
+    void add(int64_t kept, double prunedProportion) {
+        frames++;
+        hypotheses += kept;
+        maxHypotheses = std::max(maxHypotheses, kept);
+        pruned += prunedProportion;
+        maxPruned = std::max(maxPruned, prunedProportion);
+    }
+};
+
+// Add a frame's hypotheses to a lattice, which wants them in order of
+// state rather than of probability
+static void addFrame(Lattice& lattice, const vector<Hypothesis>& hypotheses,
+    vector<Hypothesis>& scratch) {
+
+        scratch = hypotheses;
+        std::sort(scratch.begin(), scratch.end(),
+                  [](const Hypothesis& a, const Hypothesis& b) {
+                      return a.state < b.state;
+                  });
+        for (const auto& h : scratch) {
+            lattice.addHypothesis(h.state.eventIndex, h.state.microIndex, h.prob);
+        }
+        lattice.endFrame();
+}
+
+// The forward lattice is indexed from the segment's first frame, and
+// the backward from its last. Each frame is calculated from the one
+// before at full precision, and only then stored. States outside the
+// corridor are neither expanded nor scored, unless that would leave no
+// hypotheses at all (e.g. because an anchor lies outside it).
+static void getForwardProbs(Lattice* forward,
+    AudioToScoreAligner& aligner, const SimpleHMM::StateGraph& graph,
+    const SimpleHMM::Segment& segment, int beamWidth) {
+
+        const auto& nextStates = graph.nextStates;
+        const auto& firstStates = graph.firstStates;
+
+        const AudioToScoreAligner::Corridor& corridor = aligner.getCorridor();
+        const AudioToScoreAligner::Corridor unconstrained;
+
+        int totalFrames = segment.endFrame - segment.startFrame;
+        BeamStats beam(aligner.getStats());
+        vector<Hypothesis> hypotheses, previous, scratch;
         // first frame:
-        hypotheses.push_back(Hypothesis(State(-1, 0), 1.));
-        forward->push_back(hypotheses);
+        for (const auto& state : firstStates) {
+            hypotheses.push_back(Hypothesis(state, 1. / firstStates.size()));
+        }
+        if (totalFrames > 0) {
+            addFrame(*forward, hypotheses, scratch);
+        }
 
         // later frames:
         for (int frame = 1; frame < totalFrames; frame++) {
+            previous.swap(hypotheses);
             hypotheses.clear();
-            for (const auto& hypo : forward->at(frame-1)) {
-                double prior = hypo.prob;
-                for (const auto& next : nextStates.at(hypo.state)) {
-                    double trans = next.second;
-                    int event = next.first.eventIndex;
-                    double like;
-                    like = aligner.getLikelihood(frame, event);
-                    hypotheses.push_back(Hypothesis(next.first, prior*trans*like));
+            for (int pass = 0; pass < 2 && hypotheses.empty(); pass++) {
+                const auto& allowed = (pass == 0 ? corridor : unconstrained);
+                for (const auto& hypo : previous) {
+                    double prior = hypo.prob;
+                    for (const auto& next : nextStates.at(hypo.state)) {
+                        if (!isInCorridor(allowed, graph, segment,
+                                          segment.startFrame + frame, next.first)) {
+                            continue;
+                        }
+                        double trans = next.second;
+                        int event = next.first.eventIndex;
+                        double like;
+                        like = getStateLikelihood(aligner, graph, segment.startFrame + frame, event);
+                        hypotheses.push_back(Hypothesis(next.first, prior*trans*like));
+                    }
                 }
             }
             // Merge, sort (and trim), and then normalize.
@@ -151,52 +346,75 @@ static void getForwardProbs(vector<vector<Hypothesis>>* forward,
                 hypotheses.push_back(Hypothesis(h.first, h.second));
             }
             std::sort(hypotheses.begin(), hypotheses.end(), std::greater<Hypothesis>());
-            if (hypotheses.size() > BEAM_SEARCH_WIDTH)
-                hypotheses.erase(hypotheses.begin() + BEAM_SEARCH_WIDTH, hypotheses.end());
+            double pruned = 0.;
+            for (size_t i = beamWidth; i < hypotheses.size(); i++) {
+                pruned += hypotheses[i].prob;
+            }
+            if (hypotheses.size() > size_t(beamWidth))
+                hypotheses.erase(hypotheses.begin() + beamWidth, hypotheses.end());
             double total = 0.;
             for (const auto& h : hypotheses) {
                 total += h.prob;
             }
-            if (total == 0) std::cerr << "In getForwardProbs: total is zero!!!" << '\n';
+            beam.add(hypotheses.size(), total + pruned > 0. ? pruned / (total + pruned) : 0.);
+            if (total == 0) LOG_WARNING("In getForwardProbs: total is zero!!!");
             for (auto& h : hypotheses) {
                 h.prob /= total;
             }
-            forward->push_back(hypotheses);
+            addFrame(*forward, hypotheses, scratch);
 
-            std::cerr << "In getForwardProbs: frame = " << frame << '\n';
-            for (auto& h : forward->at(frame)) {
-                std::cerr << "new prior = "<<Hypothesis::toString(h) << '\t'<<"likelihood = " << aligner.getLikelihood(frame, h.state.eventIndex) << '\n';
+            LOG_TRACE("In getForwardProbs: frame = " << frame);
+            for (auto& h : hypotheses) {
+                LOG_TRACE("new prior = "<<Hypothesis::toString(h) << '\t'<<"likelihood = " << getStateLikelihood(aligner, graph, segment.startFrame + frame, h.state.eventIndex));
             }
 
         }
+        forward->finish();
 }
 
 
 
-static void getBackwardProbs(vector<vector<Hypothesis>>* backward,
-    AudioToScoreAligner& aligner, const map<State, map<State, double>>& prevStates) {
+static void getBackwardProbs(Lattice* backward,
+    AudioToScoreAligner& aligner, const SimpleHMM::StateGraph& graph,
+    const SimpleHMM::Segment& segment, int beamWidth) {
 
-        int totalFrames = aligner.getDataFeatures().size();
-        backward->resize(totalFrames);
-        vector<Hypothesis> hypotheses;
+        const auto& prevStates = graph.prevStates;
+        const auto& lastStates = graph.lastStates;
+
+        const AudioToScoreAligner::Corridor& corridor = aligner.getCorridor();
+        const AudioToScoreAligner::Corridor unconstrained;
+
+        int totalFrames = segment.endFrame - segment.startFrame;
+        BeamStats beam(aligner.getStats());
+        vector<Hypothesis> hypotheses, previous, scratch;
 
         // last frame:
-        hypotheses.push_back(Hypothesis(State(-2, 0), 1.));
+        for (const auto& state : lastStates) {
+            hypotheses.push_back(Hypothesis(state, 1. / lastStates.size()));
+        }
         if (totalFrames > 0) {
-            backward->at(totalFrames - 1) = hypotheses;
+            addFrame(*backward, hypotheses, scratch);
         }
 
         for (int frame = totalFrames - 2; frame >= 0; frame--) {
+            previous.swap(hypotheses);
             hypotheses.clear();
-            for (const auto& hypo : backward->at(frame + 1)) {
-                double prior = hypo.prob;
-                int event = hypo.state.eventIndex;
-                double like;
-                like = aligner.getLikelihood(frame + 1, event);
-
-                for (const auto& prev : prevStates.at(hypo.state)) {
-                    double trans = prev.second;
-                    hypotheses.push_back(Hypothesis(prev.first, prior*trans*like));
+            for (int pass = 0; pass < 2 && hypotheses.empty(); pass++) {
+                const auto& allowed = (pass == 0 ? corridor : unconstrained);
+                for (const auto& hypo : previous) {
+                    double prior = hypo.prob;
+                    int event = hypo.state.eventIndex;
+                    double like;
+                    like = getStateLikelihood(aligner, graph, segment.startFrame + frame + 1, event);
+
+                    for (const auto& prev : prevStates.at(hypo.state)) {
+                        if (!isInCorridor(allowed, graph, segment,
+                                          segment.startFrame + frame, prev.first)) {
+                            continue;
+                        }
+                        double trans = prev.second;
+                        hypotheses.push_back(Hypothesis(prev.first, prior*trans*like));
+                    }
                 }
             }
             // Merge, sort (and trim), and then normalize.
@@ -213,92 +431,256 @@ static void getBackwardProbs(vector<vector<Hypothesis>>* backward,
                 hypotheses.push_back(Hypothesis(h.first, h.second));
             }
             std::sort(hypotheses.begin(), hypotheses.end(), std::greater<Hypothesis>());
-            if (hypotheses.size() > BEAM_SEARCH_WIDTH)
-                hypotheses.erase(hypotheses.begin() + BEAM_SEARCH_WIDTH, hypotheses.end());
+            double pruned = 0.;
+            for (size_t i = beamWidth; i < hypotheses.size(); i++) {
+                pruned += hypotheses[i].prob;
+            }
+            if (hypotheses.size() > size_t(beamWidth))
+                hypotheses.erase(hypotheses.begin() + beamWidth, hypotheses.end());
             double total = 0.;
             for (const auto& h : hypotheses) {
                 total += h.prob;
             }
-            if (total == 0) std::cerr << "In getBackwardProbs: total is zero!!!" << '\n';
+            beam.add(hypotheses.size(), total + pruned > 0. ? pruned / (total + pruned) : 0.);
+            if (total == 0) LOG_WARNING("In getBackwardProbs: total is zero!!!");
             for (auto& h : hypotheses) {
                 h.prob /= total;
             }
-            backward->at(frame) = hypotheses;
+            addFrame(*backward, hypotheses, scratch);
 /*
             std::cout << "Frame = " << frame << '\n';
-            for (auto& h : backward->at(frame)) {
+            for (auto& h : hypotheses) {
                 std::cout << Hypothesis::toString(h) << '\n';
             }
 */
         }
+        backward->finish();
 }
 
 
 
 
 
-AudioToScoreAligner::AlignmentResults SimpleHMM::getAlignmentResults()
+// The product of the forward and backward probabilities of each state
+// in both beams. Both lattices hold each frame in order of state, so
+// this is a merge of the two.
+void SimpleHMM::getPosteriors(Lattice& post)
 {
-    AudioToScoreAligner::AlignmentResults results;
-
-    vector<vector<Hypothesis>>* forward = new vector<vector<Hypothesis>>();
-
-    getForwardProbs(forward, m_aligner, m_nextStates);
-    vector<vector<Hypothesis>>* backward = new vector<vector<Hypothesis>>();
-    getBackwardProbs(backward, m_aligner, m_prevStates);
-    vector<vector<Hypothesis>> post;
-    vector<Hypothesis> hypotheses;
-    int totalFrames = m_aligner.getDataFeatures().size();
+    Lattice forward;
+    {
+        AlignmentStats::Timer timer(m_aligner.getStats(), AlignmentStats::ForwardPass);
+        getForwardProbs(&forward, m_aligner, *m_graph, m_segment, m_beamWidth);
+    }
+    Lattice backward;
+    {
+        AlignmentStats::Timer timer(m_aligner.getStats(), AlignmentStats::BackwardPass);
+        getBackwardProbs(&backward, m_aligner, *m_graph, m_segment, m_beamWidth);
+    }
+    int totalFrames = m_segment.endFrame - m_segment.startFrame;
     for (int frame = 0; frame < totalFrames; frame ++) {
-        hypotheses.clear();
-        for (const auto& hypo1 : forward->at(frame)) {
-            for (const auto& hypo2 : backward->at(frame)) {
-                if (hypo1.state == hypo2.state) {
-                    hypotheses.push_back(Hypothesis(hypo1.state, hypo1.prob * hypo2.prob));
-                    break;
+        Lattice::Reader f(forward, frame);
+        Lattice::Reader b(backward, totalFrames - 1 - frame);
+        bool more = f.next() && b.next();
+        while (more) {
+            State fs(f.getEventIndex(), f.getMicroIndex());
+            State bs(b.getEventIndex(), b.getMicroIndex());
+            if (fs < bs) {
+                more = f.next();
+            } else if (bs < fs) {
+                more = b.next();
+            } else {
+                post.addHypothesis(fs.eventIndex, fs.microIndex,
+                                   exp(double(f.getLogProb()) + double(b.getLogProb())));
+                more = f.next() && b.next();
+            }
+        }
+        post.endFrame();
+    }
+    post.finish();
+    m_aligner.getStats().count(AlignmentStats::LatticeBytes,
+                               forward.getBytes() + backward.getBytes() + post.getBytes());
+}
+
+AudioToScoreAligner::Anchors SimpleHMM::getConfidentPoints(double threshold)
+{
+    Lattice post;
+    getPosteriors(post);
+
+    AudioToScoreAligner::Anchors points;
+    map<int, int> longestRun; // event -> length of its longest confident run
+    int runEvent = -1;
+    int runStart = 0;
+    int totalFrames = post.getFrameCount();
+    for (int frame = 0; frame <= totalFrames; frame++) {
+        // The confident event at this frame, if any
+        int event = -1;
+        if (frame < totalFrames) {
+            map<int, double> merged;
+            double total = 0.;
+            for (Lattice::Reader h(post, frame); h.next(); ) {
+                merged[h.getEventIndex()] += h.getProb();
+                total += h.getProb();
+            }
+            for (const auto& m : merged) {
+                // A composite event's onsets are only found together,
+                // so the alignment must not be split within one
+                if (m_graph->composites.count(m.first)) continue;
+                if (total > 0. && m.first >= 0 && m.second / total >= threshold) {
+                    event = m.first;
                 }
             }
         }
-        post.push_back(hypotheses);
+        if (event != runEvent) {
+            if (runEvent >= 0 && frame - runStart > longestRun[runEvent]) {
+                longestRun[runEvent] = frame - runStart;
+                points[runEvent] = m_segment.startFrame + (runStart + frame) / 2;
+            }
+            runEvent = event;
+            runStart = frame;
+        }
     }
 
-    // Print posterior hypotheses:
+    return points;
+}
+
+AudioToScoreAligner::Corridor SimpleHMM::getPosteriorCorridor(double threshold)
+{
+    Lattice post;
+    getPosteriors(post);
+
+    AudioToScoreAligner::Corridor corridor;
+    for (int frame = 0; frame < post.getFrameCount(); frame++) {
+        double total = 0.;
+        for (Lattice::Reader h(post, frame); h.next(); ) {
+            total += h.getProb();
+        }
+        int lowest = m_segment.endEvent;
+        int highest = m_segment.startEvent - 1;
+        for (Lattice::Reader h(post, frame); h.next(); ) {
+            if (total > 0. && h.getProb() / total < threshold) continue;
+            int event = h.getEventIndex();
+            int last = event; // of a composite event
+            if (event == -1) event = last = m_segment.startEvent - 1;
+            else if (event == -2) event = last = m_segment.endEvent;
+            else if (m_graph->composites.count(event)) last = m_graph->composites.at(event) - 1;
+            if (event < lowest) lowest = event;
+            if (last > highest) highest = last;
+        }
+        if (highest < lowest) { // nothing to go on
+            lowest = m_segment.startEvent - 1;
+            highest = m_segment.endEvent;
+        }
+        corridor.push_back({ lowest, highest });
+    }
+    return corridor;
+}
+
+// Divide the (absolute) frames [startFrame, startFrame + frames)
+// between the events [startEvent, endEvent), in order and at least one
+// frame each, so as to maximise the likelihood of the frames given
+// their events. Returns each event's onset counted from startFrame.
+static vector<int> splitComposite(AudioToScoreAligner& aligner,
+    int startFrame, int frames, int startEvent, int endEvent) {
+
+        int count = endEvent - startEvent;
+        // best[i][t]: the greatest log-likelihood of frames [0, t] with
+        // frame t in event i, and whether frame t - 1 was in it too
+        vector<vector<double>> best(count, vector<double>(frames, -HUGE_VAL));
+        vector<vector<bool>> stayed(count, vector<bool>(frames, false));
+        for (int t = 0; t < frames; t++) {
+            for (int i = 0; i < count && i <= t; i++) {
+                double like = aligner.getLikelihood(startFrame + t, startEvent + i);
+                double logLike = log(std::max(like, std::numeric_limits<double>::min()));
+                if (t == 0) {
+                    best[i][t] = logLike;
+                    continue;
+                }
+                double stay = best[i][t-1];
+                double enter = (i > 0 ? best[i-1][t-1] : -HUGE_VAL);
+                stayed[i][t] = (stay >= enter);
+                best[i][t] = logLike + std::max(stay, enter);
+            }
+        }
+        vector<int> onsets(count, 0);
+        int i = count - 1;
+        for (int t = frames - 1; t > 0 && i > 0; t--) {
+            if (!stayed[i][t]) onsets[i--] = t;
+        }
+        return onsets;
+}
+
+// The first frame from startFrame at which the posterior of being in
+// event is at least a half, or -1 if there is none
+static int getFirstOccupiedFrame(const Lattice& post, int startFrame, int event) {
 
-    int frame = 0;
-    // std::cout << "Forward!!!" << '\n';
-     for (auto& p : post) { // *forward
-         std::sort(p.begin(), p.end(), std::greater<Hypothesis>());
-         //std::cerr << "### Frame = " << frame << '\n';
-         // std::cerr << "### real time = " <<Vamp::RealTime::frame2RealTime(frame*(128.*6.), 48000)<< '\n'; // m_firstFrameTime is 0 in SV
-         for (const auto& h : p) {
-             //std::cerr << Hypothesis::toString(h) << '\n';
-         }
-         frame++;
-     }
+        for (int frame = startFrame; frame < post.getFrameCount(); frame++) {
+            double total = 0., occupied = 0.;
+            for (Lattice::Reader h(post, frame); h.next(); ) {
+                total += h.getProb();
+                if (h.getEventIndex() == event) occupied += h.getProb();
+            }
+            if (total > 0. && occupied >= total / 2) return frame;
+        }
+        return -1;
+}
 
+AudioToScoreAligner::AlignmentResults SimpleHMM::getAlignmentResults()
+{
+    AudioToScoreAligner::AlignmentResults results;
 
+    Lattice post;
+    getPosteriors(post);
 
+    AlignmentStats::Timer timer(m_aligner.getStats(), AlignmentStats::OnsetExtraction);
 
     // Window
     int windowSize = 3; // TODO: Check and make sure it's always an odd number.
-    std::cout << "windowSize/2 = "<<windowSize/2 << '\n';
-    int numEvents = m_aligner.getScore().getMusicalEvents().size();
+    LOG_DEBUG("windowSize/2 = "<<windowSize/2);
     int startFrame = 0;
-    for (int event = 0; event < numEvents; event++) {
+    int compositeStart = -1, compositeEnd = -1; // the last composite event found
+    Score::EventArrays events = m_aligner.getScore().getEventArrays();
+    for (int event = m_segment.startEvent; event < m_segment.endEvent; event++) {
+        if (m_graph->composites.count(event)) {
+            compositeStart = event;
+            compositeEnd = m_graph->composites.at(event);
+        }
+        if (event == m_segment.startEvent && m_segment.start == Onset) {
+            results.push_back(0); // anchored
+            continue;
+        }
+        if (event == m_segment.startEvent && m_segment.start == Within) {
+            results.push_back(-1); // began before the segment
+            continue;
+        }
+        if (event > compositeStart && event < compositeEnd) {
+            results.push_back(results.back()); // see below
+            continue;
+        }
         if (results.size() == 0)    startFrame = 0;
         else startFrame = results[results.size()-1] - windowSize/2 + 1;
         if (startFrame < 0) startFrame = 0;
         double bestScore = 0.;
-        int bestStartFrame;
-        for (int frame = startFrame; frame + windowSize < post.size() + 1; frame++) {
+        int bestStartFrame = startFrame; // in case no frame scores above zero
+        if (event == compositeStart ||
+            getNominalFrames(events, event, m_aligner.getSampleRate(),
+                             m_aligner.getHopSize()) < 1.) {
+            // A composite event, or one shorter than a frame, has a
+            // single state that it may occupy for just one frame, which
+            // every window over that frame scores alike, so take the
+            // first frame at which it is more likely than not, reported
+            // like any other onset at the centre of a window from there
+            int onset = getFirstOccupiedFrame(post, startFrame, event);
+            if (onset >= 0) {
+                results.push_back(std::min(onset + windowSize/2,
+                                           post.getFrameCount() - 1));
+                continue;
+            }
+        }
+        for (int frame = startFrame; frame + windowSize < post.getFrameCount() + 1; frame++) {
             // find the best startFrame for this event, and add frame to result:
             double score = 0.;
             for (int t = frame; t < frame + windowSize; t++) {
-                for (const auto& h: post[t]) {
-                    if (h.state.eventIndex == event && h.state.microIndex == 0) {
-                        score += h.prob;
-                    }
-                }
+                score += post.getProb(t, event, 0);
             }
             if (score > bestScore) {
                 bestScore = score;
@@ -306,36 +688,53 @@ AudioToScoreAligner::AlignmentResults SimpleHMM::getAlignmentResults()
             }
         }
         results.push_back(bestStartFrame);
-        std::cerr << "Event="<<event<<", bestStartFrame = " << bestStartFrame << '\n';
+        LOG_DEBUG("Event="<<event<<", bestStartFrame = " << m_segment.startFrame + bestStartFrame);
     }
 
-    return results;
-
-
-
-// Return the the event with maximum posterior prob for each frame.
-    frame = 0;
-    for (const auto& l : post) {//*forward
-        map<int, double> merged;
-        for (const auto& h : l) {
-            if (merged.find(h.state.eventIndex) == merged.end()) {
-                merged[h.state.eventIndex] = h.prob;
-            } else {
-                merged[h.state.eventIndex] += h.prob;
+    // Only a composite event's first onset is found. Split the frames
+    // from there to the next event's onset between its events where
+    // their likelihoods fit best, or if the next event is not in the
+    // segment (or is too close), spread them over their nominal lengths.
+    // Onsets are reported windowSize/2 frames after the frame at which
+    // an event begins, so the frames split are that much earlier.
+    for (const auto& composite : m_graph->composites) {
+        int first = composite.first - m_segment.startEvent;
+        int end = composite.second - m_segment.startEvent;
+        int count = end - first;
+        if (results[first] < 0) continue; // all began before the segment
+        int next = -1;
+        if (end < int(results.size())) next = results[end];
+        else if (m_segment.end == Onset) next = post.getFrameCount();
+        int begins = std::max(results[first] - windowSize/2, 0);
+        int ends = next - windowSize/2;
+        if (ends - begins >= count) {
+            vector<int> onsets = splitComposite(m_aligner,
+                m_segment.startFrame + begins, ends - begins,
+                composite.first, composite.second);
+            for (int i = 1; i < count; i++) {
+                results[first + i] = begins + onsets[i] + windowSize/2;
             }
+            continue;
         }
-        double highest = 0.;
-        int record = 0;
-        for (const auto& p : merged) {
-            if (p.second > highest) {
-                highest = p.second;
-                record = p.first;
-            }
+        vector<double> offsets; // nominal, from the first onset
+        double length = 0.;
+        for (int event = composite.first; event < composite.second; event++) {
+            offsets.push_back(length);
+            length += getNominalFrames(events, event, m_aligner.getSampleRate(),
+                                       m_aligner.getHopSize());
+        }
+        for (int i = 1; i < count; i++) {
+            int onset = results[first];
+            if (length > 0.) onset += int(round(offsets[i]));
+            if (next > results[first] && onset >= next) onset = next - 1;
+            if (onset >= post.getFrameCount()) onset = post.getFrameCount() - 1;
+            results[first + i] = onset;
         }
-        //std::cout << "Frame = "<<frame<< '\n';
-        //std::cout << "record = "<<record<<", highest prob = " <<highest << '\n';
-        frame++;
-        // results.push_back(record);
     }
+
+    for (auto& r : results) {
+        if (r >= 0) r += m_segment.startFrame;
+    }
+
     return results;
 }
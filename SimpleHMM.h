@@ -9,15 +9,49 @@
 
 #include <vector>
 #include <map>
+#include <memory>
 #include <sstream> // for printing probs with high precision
 
 using std::vector;
 
+class Lattice;
 
 class SimpleHMM
 {
 public:
+    // How a segment joins the rest of the alignment at either end.
+    enum Boundary {
+        Free, // starts (or ends) in a silent state outside the segment's events
+        Onset, // the first event begins at the first frame (or the event
+               // following the segment begins just after the last frame)
+        Within // starts (or ends) part way through the first (or last) event
+    };
+
+    // Part of the alignment problem: the events [startEvent, endEvent)
+    // against the frames [startFrame, endFrame).
+    struct Segment {
+        int startEvent;
+        int endEvent;
+        int startFrame;
+        int endFrame;
+        Boundary start;
+        Boundary end;
+
+        Segment(int se, int ee, int sf, int ef, Boundary s, Boundary e) :
+         startEvent{se}, endEvent{ee}, startFrame{sf}, endFrame{ef},
+         start{s}, end{e} { }
+
+        bool operator==(const Segment &other) const {
+            return startEvent == other.startEvent &&
+             endEvent == other.endEvent && startFrame == other.startFrame &&
+             endFrame == other.endFrame && start == other.start &&
+             end == other.end;
+        }
+    };
+
+    // Align the aligner's whole event range against all of its frames.
     SimpleHMM(AudioToScoreAligner& aligner); // not const bc of getLikelihood()
+    SimpleHMM(AudioToScoreAligner& aligner, const Segment& segment);
     ~SimpleHMM();
 
     struct State {
@@ -109,13 +143,54 @@ public:
         }
     };
 
+    void setBeamWidth(int width); // default is 200
+
+    // One onset frame for each event in the segment, counted from the
+    // start of the aligner's frames rather than the segment's. If the
+    // segment starts Within its first event, that event's onset is
+    // before the segment and is returned as -1. The events of a
+    // composite (see StateGraph) are spread over the frames it occupies.
     AudioToScoreAligner::AlignmentResults getAlignmentResults();
+
+    // Points at which the posterior is at least threshold for being
+    // within a single event, as (event, frame) pairs taking the middle
+    // frame of the longest such run for each event. These are safe
+    // places to split the alignment into Within-bounded segments.
+    AudioToScoreAligner::Anchors getConfidentPoints(double threshold);
+
+    // For each frame of the segment, the range of events (with the
+    // silent states counting as the events either side of the
+    // segment) having posterior of at least threshold.
+    AudioToScoreAligner::Corridor getPosteriorCorridor(double threshold);
+
     const map<State, map<State, double>>& getNextStates() const;
 
+    // The states and transitions for a segment. These depend only on
+    // the score, the hop size and the segment's events and boundaries,
+    // not on its frames, so can be shared by any number of SimpleHMMs.
+    struct StateGraph {
+        map<State, map<State, double>> nextStates; // value is <next state, trans prob>
+        map<State, map<State, double>> prevStates; // value is <prev state, trans prob>
+        vector<State> firstStates; // where the forward pass starts
+        vector<State> lastStates; // where the backward pass starts
+
+        // Runs of consecutive events each shorter than a frame, merged
+        // into composite events: the first event of each run -> the
+        // event after it. A composite's states carry its first event's
+        // index, and the other events in it have none.
+        map<int, int> composites;
+    };
+
+    static std::shared_ptr<const StateGraph> buildStateGraph(const Score& score,
+        float sampleRate, int hopSize, const Segment& segment);
+
 private:
-    AudioToScoreAligner m_aligner;
-    map<State, map<State, double>> m_nextStates; // value is <next state, trans prob>
-    map<State, map<State, double>> m_prevStates; // value is <prev state, trans prob>
+    AudioToScoreAligner& m_aligner;
+    Segment m_segment;
+    int m_beamWidth;
+    std::shared_ptr<const StateGraph> m_graph;
+
+    void getPosteriors(Lattice& post);
 };
 
 #endif
@@ -3,10 +3,13 @@
 */
 
 #include "Templates.h"
+#include "Log.h"
 
+#include <algorithm>
 #include <cmath>
-#include <iostream>
 #include <map>
+#include <mutex>
+#include <utility>
 #include <vector>
 
 
@@ -15,15 +18,54 @@ static const int LOW_MIDI = 21;
 static const int HIGH_MIDI = 108;
 static const int MAX_HARMONICS_COUNT = 16;
 
-static float peakFunction(float x) { // MAY CHANGE THIS FUNCTION LATER
-    return exp(-0.5*x*x);
-}
+// Peak values below this are left out of sparse templates. They are far
+// below the resolution of a float template once the background
+// (at least 0.05 * 0.5 / bins) is added.
+static const float SPARSE_THRESHOLD = 1e-12f;
+
+// Each harmonic's peak is evaluated only within this many sigmas of its
+// centre. Beyond that it is below exp(-32), well under SPARSE_THRESHOLD.
+static const double PEAK_SUPPORT = 8.;
 
 static float midiToFreq(int midi) {
     return pow(2., (midi-69)/12.)*440.;
 }
 
-static void initializeNoteTemplates(float sr, int blockSize, NoteTemplates& t) { // Is "static" unnecessary here?
+// Add one harmonic's peak, exp(-k*0.01) * exp(-x*x/2) / sigma with
+// x = (k-centre)/sigma, to acc over the bins within PEAK_SUPPORT sigmas
+// of its centre. Successive values differ by a ratio that itself
+// changes by a constant factor, so the peak needs a handful of exp()
+// calls rather than one per bin.
+static void addPeak(vector<double>& acc, int centre, double sigma, int& lo, int& hi) {
+    int bins = acc.size();
+    int width = ceil(PEAK_SUPPORT * sigma);
+    int first = std::max(0, centre - width);
+    int last = std::min(bins - 1, centre + width);
+    double a = 1. / (sigma * sigma);
+    double q = exp(-a); // ratio between successive ratios
+    double peak = exp(-centre * 0.01) / sigma;
+
+    acc[centre] += peak;
+    double value = peak;
+    double ratio = exp(-0.5 * a - 0.01);
+    for (int k = centre + 1; k <= last; k++) {
+        value *= ratio;
+        ratio *= q;
+        acc[k] += value;
+    }
+    value = peak;
+    ratio = exp(-0.5 * a + 0.01);
+    for (int k = centre - 1; k >= first; k--) {
+        value *= ratio;
+        ratio *= q;
+        acc[k] += value;
+    }
+
+    lo = std::min(lo, first);
+    hi = std::max(hi, last);
+}
+
+static void initializeNoteTemplates(float sr, int blockSize, SparseNoteTemplates& sparse) {
     int scale = 6; // This is hard-coded for now; needs to be changed later.
     int bins = (blockSize/2)/scale; // no DC
     int N = blockSize;
@@ -41,12 +83,13 @@ static void initializeNoteTemplates(float sr, int blockSize, NoteTemplates& t) {
             silenceTemplate.push_back(p2);
         }
     }
+    sparse.binCount = bins;
+    sparse.background = silenceTemplate;
 
-
-
+    vector<double> acc(bins, 0.);
     for (int midi = LOW_MIDI; midi <= HIGH_MIDI; midi++) {
         float f0 = midiToFreq(midi);
-        t[midi].resize(bins, 0);
+        int lo = bins, hi = -1; // range of acc touched
 
         int h = 1; // first harmonic
         int bin = round(1*f0*N/(double)sr) - 1; // The "-1" may not matter.
@@ -54,43 +97,76 @@ static void initializeNoteTemplates(float sr, int blockSize, NoteTemplates& t) {
         while (bin < bins && h <= MAX_HARMONICS_COUNT) {
             float sigma = bin * 0.01 + 0.01; // Need to test these constants
             if (sigma < 1.) sigma = 1.; // lower bound of sigma
-            for (int k = 0; k < bins; k++) {
-                float x = (k-bin)/sigma;
-                t[midi][k] += exp(-k*0.01)*peakFunction(x) / sigma; // 0.01//0.1
-                //if (peakFunction(x) == 0) {
-                    //std::cerr << "!!!!peakFunction returns 0: midi=" << midi <<"bin="<<bin<<"k="<<k<< '\n';
-                //}
-            }
+            addPeak(acc, bin, sigma, lo, hi);
             h++;
             bin = round(h*f0*N/(double)sr); // hth harmonic
         }
-        //Normalize:
-        float total = 0;
-        for (const auto &value: t[midi]) {
-            total += value;
+        //Normalize, keeping only the significant values:
+        double total = 0;
+        for (int k = lo; k <= hi; k++) {
+            total += acc[k];
         }
+        SparseNoteTemplate& peaks = sparse.notes[midi];
         if (total == 0.) {
-            std::cerr << "In initializeNoteTemplates: total is 0 for midi "<< midi << '\n'; // midi 108 exceeds 4k Hz.
-        } else {
-            for (auto &value: t[midi]) {
-                value /= total;
-            }
+            LOG_DEBUG("In initializeNoteTemplates: total is 0 for midi "<< midi); // midi 108 exceeds 4k Hz.
         }
-        // Add background:
-        for (int bin = 0; bin < bins; bin++) {
-            t[midi][bin] = 0.95 * t[midi][bin] + 0.05 * silenceTemplate[bin];
+        for (int k = lo; k <= hi; k++) {
+            float value = acc[k] / total;
+            if (value > SPARSE_THRESHOLD) {
+                peaks.bins.push_back(k);
+                peaks.values.push_back(value);
+            }
+            acc[k] = 0.;
         }
     }
 }
 
+// Templates are built for each geometry the first time it is asked for
+// and kept for the life of the process
+typedef std::pair<float, int> Geometry;
+
+const SparseNoteTemplates&
+CreateNoteTemplates::getSparseNoteTemplates(float sampleRate, int blockSize)
+{
+    static std::map<Geometry, SparseNoteTemplates> cache;
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> guard(mutex);
+    auto key = std::make_pair(sampleRate, blockSize);
+    auto itr = cache.find(key);
+    if (itr == cache.end()) {
+        itr = cache.insert({ key, SparseNoteTemplates() }).first;
+        initializeNoteTemplates(sampleRate, blockSize, itr->second);
+    }
+    return itr->second;
+}
+
 const NoteTemplates&
 CreateNoteTemplates::getNoteTemplates(float sampleRate, int blockSize)
 {
-    static NoteTemplates t;
-    static bool haveInitializedTemplates = false;
-    if (!haveInitializedTemplates) {
-        initializeNoteTemplates(sampleRate, blockSize, t);
-        haveInitializedTemplates = true;
+    const SparseNoteTemplates& sparse = getSparseNoteTemplates(sampleRate, blockSize);
+
+    static std::map<Geometry, NoteTemplates> cache;
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> guard(mutex);
+    auto key = std::make_pair(sampleRate, blockSize);
+    auto itr = cache.find(key);
+    if (itr == cache.end()) {
+        itr = cache.insert({ key, NoteTemplates() }).first;
+        // Add background, in the same pass as spreading out the peaks:
+        for (const auto& note : sparse.notes) {
+            Template& t = itr->second[note.first];
+            t.resize(sparse.binCount);
+            const SparseNoteTemplate& peaks = note.second;
+            size_t i = 0;
+            for (int bin = 0; bin < sparse.binCount; bin++) {
+                float peak = 0.f;
+                if (i < peaks.bins.size() && peaks.bins[i] == bin) {
+                    peak = peaks.values[i++];
+                }
+                t[bin] = sparse.peakWeight * peak +
+                    sparse.backgroundWeight * sparse.background[bin];
+            }
+        }
     }
-    return t;
+    return itr->second;
 }
@@ -14,9 +14,28 @@ using std::vector;
 typedef vector<float> Template; // for an individual note, or for a musical event
 typedef map<int, Template> NoteTemplates; // key is midi
 
+// The harmonic peaks of a note template, normalised to sum to 1 and
+// kept only on the bins where they are significant
+struct SparseNoteTemplate {
+    vector<int> bins; // in increasing order
+    vector<float> values;
+};
+
+// Note templates split into their peaks and the background they all
+// share, so that a note's dense template is
+//   peakWeight * peaks + backgroundWeight * background
+// (or just backgroundWeight * background if it has no peaks)
+struct SparseNoteTemplates {
+    int binCount = 0;
+    Template background; // sums to 1
+    map<int, SparseNoteTemplate> notes; // key is midi
+    double peakWeight = 0.95;
+    double backgroundWeight = 0.05;
+};
 
 struct CreateNoteTemplates {
     static const NoteTemplates& getNoteTemplates(float sampleRate, int blockSize);
+    static const SparseNoteTemplates& getSparseNoteTemplates(float sampleRate, int blockSize);
 };
 
 /*
@@ -0,0 +1,147 @@
+/*
+  A work-stealing thread pool.
+*/
+
+#include "ThreadPool.h"
+#include "Log.h"
+
+#include <cstdlib>
+
+// The pool and worker the current thread belongs to, if any
+static thread_local const ThreadPool* currentPool = nullptr;
+static thread_local int currentWorker = -1;
+
+static std::mutex sharedMutex;
+static bool sharedCreated = false;
+static int sharedThreads = 0;
+
+// The size of the shared pool, which from now on is fixed
+static int getSharedThreadCount()
+{
+    std::lock_guard<std::mutex> guard(sharedMutex);
+    sharedCreated = true;
+    if (sharedThreads > 0) return sharedThreads;
+    const char* value = getenv("PIANO_ALIGNER_THREADS");
+    if (!value || !*value) return 0;
+    int threads = atoi(value);
+    if (threads <= 0) {
+        LOG_WARNING("ThreadPool: ignoring PIANO_ALIGNER_THREADS \"" << value << "\"");
+    }
+    return threads;
+}
+
+
+ThreadPool::ThreadPool(int threads) :
+    m_queued{0}, m_unfinished{0}, m_nextQueue{0}, m_stopping{false}
+{
+    if (threads <= 0) threads = std::thread::hardware_concurrency();
+    if (threads <= 0) threads = 1;
+    for (int t = 0; t < threads; t++) {
+        m_queues.push_back(std::make_unique<Queue>());
+    }
+    for (int t = 0; t < threads; t++) {
+        m_threads.push_back(std::thread([this, t]() { run(t); }));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    wait();
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    for (auto& thread : m_threads) thread.join();
+}
+
+int ThreadPool::getThreadCount() const
+{
+    return m_threads.size();
+}
+
+ThreadPool& ThreadPool::getShared()
+{
+    static ThreadPool shared(getSharedThreadCount());
+    return shared;
+}
+
+bool ThreadPool::setSharedThreadCount(int threads)
+{
+    std::lock_guard<std::mutex> guard(sharedMutex);
+    if (sharedCreated) return false;
+    sharedThreads = threads;
+    return true;
+}
+
+void ThreadPool::submit(std::function<void()> task, Priority priority)
+{
+    int queue;
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        ++m_unfinished;
+        queue = (currentPool == this ? currentWorker : m_nextQueue++ % m_queues.size());
+    }
+    {
+        std::lock_guard<std::mutex> guard(m_queues[queue]->mutex);
+        m_queues[queue]->tasks[priority].push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        ++m_queued;
+    }
+    m_wake.notify_one();
+}
+
+void ThreadPool::wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this]() { return m_unfinished == 0; });
+}
+
+bool ThreadPool::take(int worker, std::function<void()>& task)
+{
+    // At each priority from the highest, the newest of our own first,
+    // then the oldest of anyone else's
+    int count = m_queues.size();
+    for (int priority = PriorityCount - 1; priority >= 0; priority--) {
+        for (int i = 0; i < count; i++) {
+            Queue& queue = *m_queues[(worker + i) % count];
+            std::lock_guard<std::mutex> guard(queue.mutex);
+            auto& tasks = queue.tasks[priority];
+            if (tasks.empty()) continue;
+            if (i == 0) {
+                task = std::move(tasks.back());
+                tasks.pop_back();
+            } else {
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::run(int worker)
+{
+    currentPool = this;
+    currentWorker = worker;
+    while (true) {
+        std::function<void()> task;
+        if (take(worker, task)) {
+            {
+                std::lock_guard<std::mutex> guard(m_mutex);
+                --m_queued;
+            }
+            task();
+            task = nullptr; // release anything it holds before counting it done
+            std::lock_guard<std::mutex> guard(m_mutex);
+            if (--m_unfinished == 0) m_done.notify_all();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_wake.wait(lock, [this]() { return m_queued > 0 || m_stopping; });
+        if (m_stopping && m_queued <= 0) return;
+    }
+}
@@ -0,0 +1,87 @@
+/*
+  A work-stealing thread pool. Each worker takes the tasks it submitted
+  itself most recently first, and when it has none left takes the
+  oldest of another worker's, so that a few long tasks do not leave
+  the other workers idle behind them.
+
+  Tasks of higher priority are taken before any of lower priority,
+  wherever they were queued.
+
+  One pool is shared by everything in the process (see getShared), so
+  that several plugin instances aligning at once share the cores
+  rather than each starting threads of its own.
+*/
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using std::vector;
+
+
+class ThreadPool
+{
+public:
+    enum Priority {
+        Low,
+        Normal,
+        High,
+        PriorityCount
+    };
+
+    // One worker per core if threads is zero or less
+    ThreadPool(int threads = 0);
+
+    // Waits for every task already submitted
+    ~ThreadPool();
+
+    int getThreadCount() const;
+
+    // Queue a task. Tasks may submit further tasks.
+    void submit(std::function<void()> task, Priority priority = Normal);
+
+    // Wait until every task submitted so far has finished. Not to be
+    // called from a task, nor on the shared pool by anyone but its
+    // only user.
+    void wait();
+
+    // The pool shared by the whole process, created on first use with
+    // PIANO_ALIGNER_THREADS workers if that is set, and otherwise one
+    // per core
+    static ThreadPool& getShared();
+
+    // Size the shared pool. Only has an effect before its first use,
+    // and returns false after.
+    static bool setSharedThreadCount(int threads);
+
+private:
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks[PriorityCount];
+    };
+    vector<std::unique_ptr<Queue>> m_queues; // one per worker
+    vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake; // tasks are queued, or stopping
+    std::condition_variable m_done; // nothing is queued or running
+    int m_queued;
+    int m_unfinished; // queued or running
+    unsigned m_nextQueue; // for tasks submitted from outside
+    bool m_stopping;
+
+    void run(int worker);
+    bool take(int worker, std::function<void()>& task);
+};
+
+#endif
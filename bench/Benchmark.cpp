@@ -0,0 +1,341 @@
+/*
+  Benchmarks for the aligner, run on synthetic scores and performances
+  of them so that every onset is known. Each stage is timed
+  separately, across score sizes and performance lengths, with and
+  without grace notes, and the onsets found are checked against the
+  known ones.
+
+  Usage: score-aligner-bench [--quick] [--dir DIR] [--save FILE] [--check FILE]
+
+  --quick       run only the smaller cases
+  --dir DIR     write the synthetic scores under DIR (default: a
+                directory in the system's temporary directory)
+  --save FILE   write the onsets found for every case to FILE
+  --check FILE  compare the onsets found with those saved in FILE, and
+                fail if any differ, e.g. to show that an optimisation
+                has not changed the results
+
+  The exit status is also non-zero if too few onsets are close to the
+  known ones. The exact, close and error columns compare with the known
+  onsets as the aligner reports them, see ONSET_OFFSET; the grace
+  column is the error for grace notes alone.
+*/
+
+#include "AudioToScoreAligner.h"
+#include "EventTemplates.h"
+#include "Score.h"
+#include "ScoreModel.h"
+#include "SyntheticPerformance.h"
+#include "SyntheticScore.h"
+#include "Templates.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+static const float SAMPLE_RATE = 44100.f;
+static const int HOP_SIZE = 768;
+static const int BLOCK_SIZE = 6144;
+
+// Events either side of the sounding one whose likelihoods are timed
+// in each frame, about as many as the beam visits
+static const int LIKELIHOOD_EVENT_MARGIN = 10;
+
+// An onset is close if within this many frames of the known one, and
+// at least this proportion of onsets should be
+static const int CLOSE_FRAMES = 2;
+static const double MIN_CLOSE_PROPORTION = 0.9;
+
+// SimpleHMM reports an onset at the centre of the 3-frame window in
+// which it is most likely, one frame after the frame at which the
+// event begins sounding, so the known onsets are compared with that
+static const int ONSET_OFFSET = 1;
+
+struct Case {
+    int events; // not counting grace notes
+    int maxChordSize;
+    double stretch; // of the nominal timing, so of the performance length
+    int graceNotes; // before each event, merged by the aligner into composites
+};
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double getValue(const AlignmentStats::Values& values, string name)
+{
+    for (const auto& value : values) {
+        if (value.first == name) return value.second;
+    }
+    return 0.;
+}
+
+static bool setScorePath(const std::filesystem::path& dir)
+{
+#ifdef _WIN32
+    return _putenv_s("PIANO_ALIGNER_SCORE_PATH", dir.string().c_str()) == 0;
+#else
+    return setenv("PIANO_ALIGNER_SCORE_PATH", dir.string().c_str(), 1) == 0;
+#endif
+}
+
+static string getCaseName(const Case& c)
+{
+    std::ostringstream name;
+    name << "bench-" << c.events << "-" << c.maxChordSize << "-" << c.stretch;
+    if (c.graceNotes > 0) name << "-g" << c.graceNotes;
+    return name.str();
+}
+
+// Run one case, printing a row of the table. Returns the onsets found,
+// or an empty vector on failure.
+static AudioToScoreAligner::AlignmentResults runCase(const Case& c,
+    const std::filesystem::path& dir, bool& accurate)
+{
+    using clock = std::chrono::steady_clock;
+    string name = getCaseName(c);
+
+    SyntheticScore::Parameters scoreParameters;
+    scoreParameters.events = c.events;
+    scoreParameters.maxChordSize = c.maxChordSize;
+    scoreParameters.graceNotes = c.graceNotes;
+    SyntheticScore synthetic(scoreParameters);
+    if (!synthetic.write(dir, name)) {
+        std::cerr << "Failed to write score " << name << " to " << dir << std::endl;
+        return {};
+    }
+    std::filesystem::path scoreBase = dir / name / name;
+
+    // Parsing alone
+    auto start = clock::now();
+    Score score;
+    if (!score.initialize(scoreBase.string() + ".solo") ||
+        !score.readTempo(scoreBase.string() + ".tempo") ||
+        !score.readMeter(scoreBase.string() + ".meter")) {
+        std::cerr << "Failed to parse score " << name << std::endl;
+        return {};
+    }
+    double parseSeconds = secondsSince(start);
+
+    // Loading the model with no compiled cache, i.e. parsing and
+    // caching (the state graph is compiled by the first full alignment)
+    auto model = std::make_shared<ScoreModel>(SAMPLE_RATE, HOP_SIZE, BLOCK_SIZE);
+    start = clock::now();
+    if (!model->load(name)) {
+        std::cerr << "Failed to load score " << name << std::endl;
+        return {};
+    }
+    double loadSeconds = secondsSince(start);
+
+    // Building every event template from scratch
+    start = clock::now();
+    {
+        EventTemplates templates(score, SAMPLE_RATE, BLOCK_SIZE);
+        templates.buildAll();
+    }
+    double templateSeconds = secondsSince(start);
+
+    SyntheticPerformance::Parameters performanceParameters;
+    performanceParameters.sampleRate = SAMPLE_RATE;
+    performanceParameters.hopSize = HOP_SIZE;
+    performanceParameters.blockSize = BLOCK_SIZE;
+    performanceParameters.stretch = c.stretch;
+    SyntheticPerformance performance(synthetic, performanceParameters);
+    const auto& features = performance.getFeatures();
+    const auto& truth = performance.getOnsets();
+    int frames = features.size();
+    int events = truth.size(); // grace notes included
+
+    // Likelihoods in a band around the sounding event, calculated and
+    // then again from the cache
+    AudioToScoreAligner likelihoods(model);
+    for (const auto& spectrum : features) likelihoods.supplyFeature(spectrum);
+    vector<std::pair<int, int>> band;
+    int event = 0;
+    for (int frame = 0; frame < frames; frame++) {
+        while (event + 1 < events && truth[event + 1] <= frame) event++;
+        band.push_back({ std::max(event - LIKELIHOOD_EVENT_MARGIN, 0),
+                         std::min(event + LIKELIHOOD_EVENT_MARGIN + 1, events) });
+    }
+    double sum = 0.;
+    int64_t evaluations = 0;
+    double likelihoodSeconds[2];
+    for (int pass = 0; pass < 2; pass++) {
+        start = clock::now();
+        for (int frame = 0; frame < frames; frame++) {
+            for (int e = band[frame].first; e < band[frame].second; e++) {
+                sum += likelihoods.getLikelihood(frame, e);
+                if (pass == 0) evaluations++;
+            }
+        }
+        likelihoodSeconds[pass] = secondsSince(start);
+    }
+    if (sum < 0.) std::cerr << "(negative likelihood sum)" << std::endl; // keep sum live
+
+    // The whole alignment, on an aligner of its own
+    AudioToScoreAligner aligner(model);
+    for (const auto& spectrum : features) aligner.supplyFeature(spectrum);
+    start = clock::now();
+    AudioToScoreAligner::AlignmentResults results = aligner.align();
+    double alignSeconds = secondsSince(start);
+    AlignmentStats::Values stats = aligner.getStatistics();
+
+    int exact = 0, close = 0, graceNotes = 0;
+    double error = 0., graceError = 0.;
+    for (int i = 0; i < events && i < int(results.size()); i++) {
+        int difference = std::abs(results[i] - (truth[i] + ONSET_OFFSET));
+        if (difference == 0) exact++;
+        if (difference <= CLOSE_FRAMES) close++;
+        error += difference;
+        if (synthetic.isGraceNote(i)) {
+            graceNotes++;
+            graceError += difference;
+        }
+    }
+    accurate = (results.size() == truth.size() &&
+                close >= MIN_CLOSE_PROPORTION * events);
+
+    double ns = 1e9 / std::max<int64_t>(evaluations, 1);
+    std::cout << std::left << std::setw(22) << name << std::right << std::fixed
+              << std::setw(7) << frames
+              << std::setprecision(4)
+              << std::setw(9) << parseSeconds
+              << std::setw(9) << loadSeconds
+              << std::setw(9) << templateSeconds
+              << std::setprecision(0)
+              << std::setw(8) << likelihoodSeconds[0] * ns
+              << std::setw(8) << likelihoodSeconds[1] * ns
+              << std::setprecision(4)
+              << std::setw(9) << getValue(stats, "forward.seconds")
+              << std::setw(9) << getValue(stats, "backward.seconds")
+              << std::setw(9) << getValue(stats, "onsetExtraction.seconds")
+              << std::setw(9) << alignSeconds
+              << std::setprecision(3)
+              << std::setw(8) << double(exact) / events
+              << std::setw(8) << double(close) / events
+              << std::setw(8) << error / events;
+    if (graceNotes > 0) {
+        std::cout << std::setw(8) << graceError / graceNotes;
+    } else {
+        std::cout << std::setw(8) << "-";
+    }
+    std::cout << (accurate ? "" : "  INACCURATE") << std::endl;
+
+    return results;
+}
+
+int main(int argc, char** argv)
+{
+    bool quick = false;
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "piano-aligner-bench";
+    string saveFile, checkFile;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--quick")) {
+            quick = true;
+        } else if (!strcmp(argv[i], "--dir") && i + 1 < argc) {
+            dir = argv[++i];
+        } else if (!strcmp(argv[i], "--save") && i + 1 < argc) {
+            saveFile = argv[++i];
+        } else if (!strcmp(argv[i], "--check") && i + 1 < argc) {
+            checkFile = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--quick] [--dir DIR] [--save FILE] [--check FILE]" << std::endl;
+            return 2;
+        }
+    }
+
+    if (!setScorePath(dir)) {
+        std::cerr << "Failed to set the score path" << std::endl;
+        return 1;
+    }
+
+    vector<Case> cases;
+    for (int events : { 100, 400, 1600 }) {
+        if (quick && events > 400) continue;
+        for (int maxChordSize : { 1, 4 }) {
+            for (double stretch : { 1., 2. }) {
+                if (quick && stretch > 1.) continue;
+                cases.push_back({ events, maxChordSize, stretch, 0 });
+            }
+        }
+        // Three grace notes to a frame-long composite and a single
+        // event shorter than a frame, see SimpleHMM::buildStateGraph
+        cases.push_back({ events, 4, 1., 3 });
+    }
+
+    // The note templates are shared by everything after, so time them
+    // on their own
+    auto start = std::chrono::steady_clock::now();
+    CreateNoteTemplates::getNoteTemplates(SAMPLE_RATE, BLOCK_SIZE);
+    CreateNoteTemplates::getSparseNoteTemplates(SAMPLE_RATE, BLOCK_SIZE);
+    std::cout << "note templates: " << secondsSince(start) << "s" << std::endl;
+    std::cout << "times in seconds, except likelihoods in ns each (calculated, then cached)\n"
+              << std::left << std::setw(22) << "case" << std::right
+              << std::setw(7) << "frames" << std::setw(9) << "parse"
+              << std::setw(9) << "load" << std::setw(9) << "templ"
+              << std::setw(8) << "like" << std::setw(8) << "cached"
+              << std::setw(9) << "forward" << std::setw(9) << "backward"
+              << std::setw(9) << "onsets" << std::setw(9) << "align"
+              << std::setw(8) << "exact" << std::setw(8) << "close"
+              << std::setw(8) << "error" << std::setw(8) << "grace" << std::endl;
+
+    std::map<string, string> found; // case name -> onsets, one line
+    bool ok = true;
+    for (const auto& c : cases) {
+        bool accurate = false;
+        AudioToScoreAligner::AlignmentResults results = runCase(c, dir, accurate);
+        ok = ok && accurate;
+        std::ostringstream line;
+        for (int onset : results) line << ' ' << onset;
+        found[getCaseName(c)] = line.str();
+    }
+
+    if (!saveFile.empty()) {
+        std::ofstream out(saveFile);
+        for (const auto& entry : found) {
+            out << entry.first << entry.second << '\n';
+        }
+        if (!out) {
+            std::cerr << "Failed to write " << saveFile << std::endl;
+            ok = false;
+        }
+    }
+
+    if (!checkFile.empty()) {
+        std::ifstream in(checkFile);
+        if (!in) {
+            std::cerr << "Failed to read " << checkFile << std::endl;
+            return 1;
+        }
+        int compared = 0, differing = 0;
+        string line;
+        while (std::getline(in, line)) {
+            string name = line.substr(0, line.find(' '));
+            auto itr = found.find(name);
+            if (itr == found.end()) continue; // e.g. saved without --quick
+            compared++;
+            if (name + itr->second != line) {
+                std::cerr << "Onsets differ from " << checkFile << " for " << name << std::endl;
+                differing++;
+            }
+        }
+        std::cout << "checked " << compared << " case(s) against " << checkFile
+                  << ": " << differing << " differ" << std::endl;
+        if (differing > 0 || compared == 0) ok = false;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,86 @@
+/*
+  Feature frames of a performance of a SyntheticScore.
+*/
+
+#include "SyntheticPerformance.h"
+#include "Templates.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+// Frames after an onset at which the notes are at full strength,
+// before decaying to DECAY of it
+static const int ATTACK_FRAMES = 3;
+static const double DECAY = 0.5;
+static const double NOISE_FLOOR = 1e-4;
+
+
+SyntheticPerformance::SyntheticPerformance(const SyntheticScore& score,
+                                           const Parameters& parameters)
+{
+    std::mt19937 rng(parameters.seed);
+    std::normal_distribution<double> normal(0., 1.);
+
+    const vector<vector<int>>& chords = score.getChords();
+    double framesPerEvent = score.getSecondsPerEvent() * parameters.stretch *
+        parameters.sampleRate / parameters.hopSize;
+    int frame = parameters.silentFrames;
+    int graceFrames = 0; // since the last event that was not a grace note
+    for (size_t event = 0; event < chords.size(); event++) {
+        m_onsets.push_back(frame);
+        if (score.isGraceNote(event)) { // played at a frame each
+            frame++;
+            graceFrames++;
+            continue;
+        }
+        double length = framesPerEvent * (1. + parameters.jitter * normal(rng));
+        frame += std::max(2, int(round(length)) - graceFrames);
+        graceFrames = 0;
+    }
+    int lastFrame = frame; // the last event ends here
+    int frames = lastFrame + parameters.silentFrames;
+
+    const NoteTemplates& templates =
+        CreateNoteTemplates::getNoteTemplates(parameters.sampleRate, parameters.blockSize);
+    int bins = templates.begin()->second.size();
+
+    int event = -1;
+    for (frame = 0; frame < frames; frame++) {
+        while (event + 1 < int(m_onsets.size()) && m_onsets[event + 1] <= frame) {
+            event++;
+        }
+        bool sounding = (event >= 0 && frame < lastFrame);
+        double strength = (sounding && frame - m_onsets[event] < ATTACK_FRAMES) ? 1. : DECAY;
+        AudioToScoreAligner::DataSpectrum spectrum(bins);
+        double total = 0.;
+        for (int bin = 0; bin < bins; bin++) {
+            double value = NOISE_FLOOR * (1. + 0.5 * fabs(normal(rng)));
+            if (sounding) {
+                for (int midi : chords[event]) {
+                    auto itr = templates.find(midi);
+                    if (itr == templates.end()) continue;
+                    value += itr->second[bin] * strength *
+                        (1. + parameters.noise * normal(rng));
+                }
+            }
+            value = std::max(value, 0.);
+            spectrum[bin] = value;
+            total += value;
+        }
+        for (auto& value : spectrum) {
+            value /= total;
+        }
+        m_features.push_back(spectrum);
+    }
+}
+
+const AudioToScoreAligner::DataFeatures& SyntheticPerformance::getFeatures() const
+{
+    return m_features;
+}
+
+const AudioToScoreAligner::AlignmentResults& SyntheticPerformance::getOnsets() const
+{
+    return m_onsets;
+}
@@ -0,0 +1,43 @@
+/*
+  Feature frames of a performance of a SyntheticScore, mixed from the
+  note templates with tempo jitter and noise, so that the onset of
+  every event is known exactly. Grace notes are played a frame each.
+*/
+
+#ifndef SYNTHETIC_PERFORMANCE_H
+#define SYNTHETIC_PERFORMANCE_H
+
+#include "AudioToScoreAligner.h"
+#include "SyntheticScore.h"
+
+using std::vector;
+
+
+class SyntheticPerformance
+{
+public:
+    struct Parameters {
+        float sampleRate = 44100.f;
+        int hopSize = 768;
+        int blockSize = 6144;
+        double stretch = 1.; // of the score's nominal timing
+        double jitter = 0.15; // standard deviation of each event's length, relative
+        double noise = 0.2; // standard deviation of each bin, relative
+        int silentFrames = 20; // before the first event and after the last
+        unsigned seed = 1;
+    };
+
+    SyntheticPerformance(const SyntheticScore& score, const Parameters& parameters);
+
+    // One normalised power spectrum per hop, as PianoAligner supplies
+    const AudioToScoreAligner::DataFeatures& getFeatures() const;
+
+    // The frame at which each event begins
+    const AudioToScoreAligner::AlignmentResults& getOnsets() const;
+
+private:
+    AudioToScoreAligner::DataFeatures m_features;
+    AudioToScoreAligner::AlignmentResults m_onsets;
+};
+
+#endif
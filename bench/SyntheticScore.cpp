@@ -0,0 +1,98 @@
+/*
+  Scores of a chosen size and density, for benchmarking.
+*/
+
+#include "SyntheticScore.h"
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+
+// Positions are written in ticks of this fraction of an event, the
+// length of a grace note: a 128th at 8 events to the 4/4 measure,
+// which at 120 bpm is shorter than a frame
+static const int TICKS_PER_EVENT = 16;
+
+SyntheticScore::SyntheticScore(const Parameters& parameters) :
+    m_parameters{parameters}
+{
+    std::mt19937 rng(m_parameters.seed);
+    std::uniform_int_distribution<int> size(1, std::max(1, m_parameters.maxChordSize));
+    std::uniform_int_distribution<int> midi(m_parameters.lowestMidi, m_parameters.highestMidi);
+    for (int event = 0; event < m_parameters.events; event++) {
+        for (int grace = 0; grace < m_parameters.graceNotes; grace++) {
+            m_chords.push_back({ midi(rng) });
+            m_graceNotes.push_back(true);
+        }
+        vector<int> chord;
+        for (int n = size(rng); n > 0; n--) {
+            int note = midi(rng);
+            if (std::find(chord.begin(), chord.end(), note) == chord.end()) {
+                chord.push_back(note);
+            }
+        }
+        m_chords.push_back(chord);
+        m_graceNotes.push_back(false);
+    }
+}
+
+const SyntheticScore::Parameters& SyntheticScore::getParameters() const
+{
+    return m_parameters;
+}
+
+const vector<vector<int>>& SyntheticScore::getChords() const
+{
+    return m_chords;
+}
+
+bool SyntheticScore::isGraceNote(int event) const
+{
+    return m_graceNotes[event];
+}
+
+double SyntheticScore::getSecondsPerEvent() const
+{
+    return 2. / m_parameters.eventsPerMeasure;
+}
+
+bool SyntheticScore::write(std::filesystem::path scoreDir, string name) const
+{
+    std::filesystem::path dir = scoreDir / name;
+    std::error_code ec;
+    std::filesystem::remove_all(dir, ec);
+    std::filesystem::create_directories(dir, ec);
+    if (ec) return false;
+
+    // Each line is: measure+position, position from the start of the
+    // score (both in whole notes), an unused field, midi, and velocity
+    // (0 for a note ending). The final event only ends notes.
+    int division = m_parameters.eventsPerMeasure * TICKS_PER_EVENT;
+    auto position = [&](int tick) {
+        return std::to_string(tick / division + 1) + "+" +
+            std::to_string(tick % division) + "/" + std::to_string(division);
+    };
+    std::ofstream solo(dir / (name + ".solo"));
+    int tick = 0;
+    for (int event = 0; event <= int(m_chords.size()); event++) {
+        string fraction = std::to_string(tick) + "/" + std::to_string(division);
+        if (event > 0) {
+            for (int midi : m_chords[event - 1]) {
+                solo << position(tick) << '\t' << fraction << "\tx\t" << midi << "\t0\n";
+            }
+        }
+        if (event < int(m_chords.size())) {
+            for (int midi : m_chords[event]) {
+                solo << position(tick) << '\t' << fraction << "\tx\t" << midi << "\t80\n";
+            }
+            tick += m_graceNotes[event] ? 1 : TICKS_PER_EVENT - m_parameters.graceNotes;
+        }
+    }
+
+    std::ofstream tempo(dir / (name + ".tempo"));
+    tempo << "1+0/1\t120\t1\n";
+    std::ofstream meter(dir / (name + ".meter"));
+    meter << "1\t4/4\n";
+
+    return solo && tempo && meter;
+}
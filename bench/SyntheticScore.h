@@ -0,0 +1,56 @@
+/*
+  Scores of a chosen size and density, optionally with grace notes,
+  written in the .solo, .tempo and .meter formats that Score reads,
+  for benchmarking.
+*/
+
+#ifndef SYNTHETIC_SCORE_H
+#define SYNTHETIC_SCORE_H
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+
+class SyntheticScore
+{
+public:
+    struct Parameters {
+        int events = 400; // not counting grace notes
+        int maxChordSize = 3; // each event has 1 to this many notes
+        int graceNotes = 0; // single notes of a 128th before each event
+        int eventsPerMeasure = 8; // of 4/4 at 120 bpm, so 2s a measure
+        int lowestMidi = 48;
+        int highestMidi = 83;
+        unsigned seed = 1;
+    };
+
+    // Generate a score. Each event's notes sound until the next event.
+    SyntheticScore(const Parameters& parameters);
+
+    const Parameters& getParameters() const;
+
+    // The midi numbers of each event's notes, grace notes included
+    const vector<vector<int>>& getChords() const;
+
+    bool isGraceNote(int event) const;
+
+    // The nominal time from one event (or from its first grace note)
+    // to the next, in seconds
+    double getSecondsPerEvent() const;
+
+    // Write the score as scoreDir/name/name.{solo,tempo,meter},
+    // replacing any score (and compiled cache) already there. Returns
+    // false on failure.
+    bool write(std::filesystem::path scoreDir, string name) const;
+
+private:
+    Parameters m_parameters;
+    vector<vector<int>> m_chords;
+    vector<bool> m_graceNotes;
+};
+
+#endif
@@ -0,0 +1,153 @@
+/*
+  Reading audio for the batch aligner.
+*/
+
+#include "AudioFile.h"
+#include "Log.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+static const int WAVE_FORMAT_PCM = 1;
+static const int WAVE_FORMAT_IEEE_FLOAT = 3;
+static const int WAVE_FORMAT_EXTENSIBLE = 0xfffe;
+
+// Little-endian readers, for data at any alignment
+static uint32_t readU16(const char* p)
+{
+    const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+    return u[0] | (u[1] << 8);
+}
+
+static uint32_t readU32(const char* p)
+{
+    const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+    return u[0] | (u[1] << 8) | (u[2] << 16) | (uint32_t(u[3]) << 24);
+}
+
+// A sample of the given encoding and size in bytes, scaled to [-1, 1)
+static float readSample(const char* p, bool isFloat, int bytes)
+{
+    const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+    if (isFloat) {
+        if (bytes == 4) {
+            float f;
+            uint32_t bits = readU32(p);
+            memcpy(&f, &bits, 4);
+            return f;
+        }
+        uint64_t bits = readU32(p) | (uint64_t(readU32(p + 4)) << 32);
+        double d;
+        memcpy(&d, &bits, 8);
+        return float(d);
+    }
+    switch (bytes) {
+    case 1: return (int(u[0]) - 128) / 128.f; // 8-bit WAV is unsigned
+    case 2: return int16_t(readU16(p)) / 32768.f;
+    case 3: return int32_t((u[0] << 8) | (u[1] << 16) | (uint32_t(u[2]) << 24)) / 2147483648.f;
+    default: return int32_t(readU32(p)) / 2147483648.f;
+    }
+}
+
+// Mix interleaved frames down to mono by averaging the channels
+static void mixDown(const char* data, size_t frames, int channels, bool isFloat,
+                    int bytes, vector<float>& samples)
+{
+    samples.resize(frames);
+    size_t frameBytes = size_t(channels) * bytes;
+    for (size_t i = 0; i < frames; i++) {
+        float sum = 0.f;
+        for (int c = 0; c < channels; c++) {
+            sum += readSample(data + i * frameBytes + c * bytes, isFloat, bytes);
+        }
+        samples[i] = sum / channels;
+    }
+}
+
+static bool readWav(const std::filesystem::path& path, const MappedFile& file,
+                    vector<float>& samples, float& sampleRate)
+{
+    const char* data = file.getData();
+    size_t size = file.getSize();
+    if (size < 12 || memcmp(data, "RIFF", 4) || memcmp(data + 8, "WAVE", 4)) {
+        LOG_ERROR("AudioFile: " << path.string() << " is not a WAV file");
+        return false;
+    }
+
+    int format = 0, channels = 0, bits = 0;
+    const char* samplesStart = nullptr;
+    size_t samplesSize = 0;
+    size_t offset = 12;
+    while (offset + 8 <= size) {
+        const char* chunk = data + offset;
+        size_t chunkSize = readU32(chunk + 4);
+        size_t available = std::min(chunkSize, size - offset - 8);
+        if (!memcmp(chunk, "fmt ", 4) && available >= 16) {
+            format = readU16(chunk + 8);
+            channels = readU16(chunk + 10);
+            sampleRate = readU32(chunk + 12);
+            bits = readU16(chunk + 22);
+            if (format == WAVE_FORMAT_EXTENSIBLE && available >= 26) {
+                format = readU16(chunk + 32); // the start of the subformat GUID
+            }
+        } else if (!memcmp(chunk, "data", 4)) {
+            samplesStart = chunk + 8;
+            samplesSize = available; // a truncated file gives what there is
+        }
+        offset += 8 + chunkSize + (chunkSize & 1); // chunks are word-aligned
+    }
+
+    bool isFloat = (format == WAVE_FORMAT_IEEE_FLOAT);
+    bool supported = (format == WAVE_FORMAT_PCM && bits >= 8 && bits <= 32 && bits % 8 == 0) ||
+        (isFloat && (bits == 32 || bits == 64));
+    if (!supported || channels < 1 || sampleRate <= 0.f) {
+        LOG_ERROR("AudioFile: " << path.string() << " has an unsupported format ("
+                  << format << ", " << bits << " bits, " << channels << " channels)");
+        return false;
+    }
+    if (!samplesStart) {
+        LOG_ERROR("AudioFile: " << path.string() << " has no data");
+        return false;
+    }
+    int bytes = bits / 8;
+    mixDown(samplesStart, samplesSize / (size_t(bytes) * channels), channels, isFloat,
+            bytes, samples);
+    return true;
+}
+
+bool AudioFile::read(const std::filesystem::path& path, const RawFormat& raw,
+                     vector<float>& samples, float& sampleRate)
+{
+    auto file = MappedFile::open(path);
+    if (!file) {
+        LOG_ERROR("AudioFile: cannot open " << path.string());
+        return false;
+    }
+
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    if (extension == ".wav") {
+        return readWav(path, *file, samples, sampleRate);
+    }
+
+    int bytes = 2;
+    switch (raw.encoding) {
+    case RawFormat::Int16: bytes = 2; break;
+    case RawFormat::Int24: bytes = 3; break;
+    case RawFormat::Int32: bytes = 4; break;
+    case RawFormat::Float32: bytes = 4; break;
+    }
+    if (raw.channels < 1 || raw.sampleRate <= 0.f) {
+        LOG_ERROR("AudioFile: invalid raw format for " << path.string());
+        return false;
+    }
+    sampleRate = raw.sampleRate;
+    mixDown(file->getData(), file->getSize() / (size_t(bytes) * raw.channels), raw.channels,
+            raw.encoding == RawFormat::Float32, bytes, samples);
+    return true;
+}
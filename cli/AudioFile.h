@@ -0,0 +1,35 @@
+/*
+  Reading audio for the batch aligner: WAV files (integer or float
+  PCM), or headerless PCM in a format given by the caller. Either is
+  mixed down to mono, as a Vamp host does for a one-channel plugin.
+*/
+
+#ifndef AUDIO_FILE_H
+#define AUDIO_FILE_H
+
+#include <filesystem>
+#include <vector>
+
+using std::vector;
+
+
+class AudioFile
+{
+public:
+    // The format of headerless PCM, which is little-endian and
+    // interleaved
+    struct RawFormat {
+        enum Encoding { Int16, Int24, Int32, Float32 };
+        Encoding encoding = Int16;
+        int channels = 1;
+        float sampleRate = 44100.f;
+    };
+
+    // Read a file as WAV if its name ends in .wav, and as raw PCM in
+    // the given format otherwise. Returns false, having logged why, if
+    // it cannot be read.
+    static bool read(const std::filesystem::path& path, const RawFormat& raw,
+                     vector<float>& samples, float& sampleRate);
+};
+
+#endif
@@ -0,0 +1,317 @@
+/*
+  Align many recordings against their scores from the command line,
+  without a Vamp host, spreading the recordings over every core.
+
+  Usage: score-aligner-batch [options] MANIFEST
+
+  Each line of MANIFEST is a job: an audio file and the name of a
+  score, separated by a tab, and optionally a third field giving the
+  file to write the onsets to (as JSON if its name ends in .json, and
+  otherwise as CSV). Blank lines and lines starting with #
+  are ignored. Scores are found on the score path as for the plugin,
+  see Paths.
+
+  Options:
+    --threads N        use N threads (default: PIANO_ALIGNER_THREADS if
+                       set, otherwise one per core)
+    --format csv|json  write onsets as CSV (the default) or JSON
+    --output-dir DIR   write onsets to DIR/<audio name>.<format>, for jobs
+                       that give no output file (default: next to the audio)
+    --raw-encoding E   for audio files not ending in .wav, which are read
+                       as headerless little-endian PCM: s16 (the default),
+                       s24, s32 or f32
+    --raw-channels N   channels of headerless PCM (default 1)
+    --raw-rate HZ      sample rate of headerless PCM (default 44100)
+
+  For each event the output gives its index, its position in the
+  score as measure+fraction, its onset in seconds from the start of
+  the audio, and its nominal time from the start of the score in
+  milliseconds ("ticks"), as the plugin's chordonsets output does.
+*/
+
+#include "AudioFile.h"
+#include "AudioToScoreAligner.h"
+#include "FeatureExtractor.h"
+#include "Log.h"
+#include "Score.h"
+#include "ScoreModel.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+struct Job {
+    std::filesystem::path audio;
+    string scoreName;
+    std::filesystem::path output;
+    bool json;
+};
+
+struct Options {
+    int threads = 0;
+    bool json = false;
+    std::filesystem::path outputDir;
+    AudioFile::RawFormat raw;
+};
+
+// A score model for each score and sample rate, loaded by whichever
+// job needs it first and then shared
+class ModelCache
+{
+public:
+    ModelCache(const std::map<string, int>& jobsPerScore) : m_jobsPerScore(jobsPerScore) { }
+
+    std::shared_ptr<const ScoreModel> get(string scoreName, float sampleRate) {
+        Entry* entry;
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            auto& slot = m_entries[{ scoreName, sampleRate }];
+            if (!slot) slot = std::make_unique<Entry>();
+            entry = slot.get();
+        }
+        std::call_once(entry->once, [&]() {
+            auto model = std::make_shared<ScoreModel>(sampleRate, FeatureExtractor::HOP_SIZE,
+                                                      FeatureExtractor::BLOCK_SIZE);
+            if (!model->load(scoreName)) return;
+            if (m_jobsPerScore[scoreName] > 1) {
+                // Each job would otherwise build much the same templates
+                model->precomputeTemplates();
+            }
+            entry->model = model;
+        });
+        return entry->model;
+    }
+
+private:
+    struct Entry {
+        std::once_flag once;
+        std::shared_ptr<const ScoreModel> model; // null if it failed to load
+    };
+    std::map<string, int> m_jobsPerScore;
+    std::mutex m_mutex;
+    std::map<std::pair<string, float>, std::unique_ptr<Entry>> m_entries;
+};
+
+static string escapeJson(const string& s)
+{
+    std::ostringstream out;
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (c < 0x20) {
+            out << "\\u00" << "0123456789abcdef"[c >> 4] << "0123456789abcdef"[c & 15];
+        } else {
+            out << c;
+        }
+    }
+    return out.str();
+}
+
+static bool writeOnsets(const Job& job, const Score& score,
+                        const AudioToScoreAligner::AlignmentResults& frames,
+                        float sampleRate)
+{
+    std::ofstream out(job.output, std::ios::trunc);
+    if (!out) return false;
+    out.precision(10);
+
+    const Score::MusicalEventList& events = score.getMusicalEvents();
+    if (job.json) {
+        out << "{\n  \"audio\": \"" << escapeJson(job.audio.string()) << "\",\n"
+            << "  \"score\": \"" << escapeJson(job.scoreName) << "\",\n"
+            << "  \"events\": [\n";
+    } else {
+        out << "event,label,onset,ticks\n";
+    }
+    for (int event = 0; event < int(frames.size()); event++) {
+        const Score::MeasureInfo& info = events[event].measureInfo;
+        string label = to_string(info.measureNumber) + "+" +
+            to_string(info.measurePosition.numerator) + "/" +
+            to_string(info.measurePosition.denominator);
+        double onset = double(frames[event]) * FeatureExtractor::HOP_SIZE / sampleRate;
+        double ticks = score.getEventSeconds(event) * 1000.;
+        if (job.json) {
+            out << "    { \"event\": " << event << ", \"label\": \"" << label
+                << "\", \"onset\": " << onset << ", \"ticks\": " << ticks << " }"
+                << (event + 1 < int(frames.size()) ? ",\n" : "\n");
+        } else {
+            out << event << ',' << label << ',' << onset << ',' << ticks << '\n';
+        }
+    }
+    if (job.json) {
+        out << "  ]\n}\n";
+    }
+    return bool(out);
+}
+
+static bool runJob(const Job& job, const Options& options, const FeatureExtractor& extractor,
+                   ModelCache& models)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    vector<float> samples;
+    float sampleRate = 0.f;
+    if (!AudioFile::read(job.audio, options.raw, samples, sampleRate)) {
+        return false;
+    }
+
+    auto model = models.get(job.scoreName, sampleRate);
+    if (!model) {
+        LOG_ERROR("Failed to load score " << job.scoreName << " for " << job.audio.string());
+        return false;
+    }
+
+    AudioToScoreAligner aligner(model);
+    for (auto& feature : extractor.extract(samples.data(), samples.size())) {
+        aligner.supplyFeature(std::move(feature));
+    }
+    samples = vector<float>();
+    AudioToScoreAligner::AlignmentResults frames = aligner.align();
+    if (frames.empty()) {
+        LOG_ERROR("Failed to align " << job.audio.string());
+        return false;
+    }
+
+    if (!writeOnsets(job, model->getScore(), frames, sampleRate)) {
+        LOG_ERROR("Failed to write " << job.output.string());
+        return false;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    LOG_INFO("Aligned " << job.audio.string() << " (" << aligner.getFrameCount()
+             << " frames) to " << job.scoreName << " in " << seconds << "s");
+    return true;
+}
+
+static bool readManifest(const std::filesystem::path& path, const Options& options,
+                         vector<Job>& jobs)
+{
+    std::ifstream in(path);
+    if (!in) {
+        LOG_ERROR("Cannot open manifest " << path.string());
+        return false;
+    }
+    string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+
+        vector<string> fields;
+        std::istringstream stream(line);
+        string field;
+        while (std::getline(stream, field, '\t')) fields.push_back(field);
+        if (fields.size() < 2 || fields.size() > 3 || fields[0].empty() || fields[1].empty()) {
+            LOG_ERROR("Manifest " << path.string() << " line " << lineNumber
+                      << ": expected audio<TAB>score[<TAB>output]");
+            return false;
+        }
+
+        Job job;
+        job.audio = fields[0];
+        job.scoreName = fields[1];
+        if (fields.size() == 3 && !fields[2].empty()) {
+            job.output = fields[2];
+            job.json = (job.output.extension() == ".json");
+        } else {
+            job.json = options.json;
+            std::filesystem::path dir = options.outputDir.empty() ?
+                job.audio.parent_path() : options.outputDir;
+            job.output = dir / job.audio.stem();
+            job.output += (options.json ? ".json" : ".csv");
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+static int usage(const char* name)
+{
+    std::cerr << "Usage: " << name << " [--threads N] [--format csv|json] [--output-dir DIR]\n"
+              << "       [--raw-encoding s16|s24|s32|f32] [--raw-channels N] [--raw-rate HZ]\n"
+              << "       MANIFEST\n"
+              << "Each line of MANIFEST is: audio<TAB>score[<TAB>output]" << std::endl;
+    return 2;
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    std::filesystem::path manifest;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = (i + 1 < argc);
+        if (arg == "--threads" && hasValue) {
+            options.threads = atoi(argv[++i]);
+        } else if (arg == "--format" && hasValue) {
+            string format = argv[++i];
+            if (format != "csv" && format != "json") return usage(argv[0]);
+            options.json = (format == "json");
+        } else if (arg == "--output-dir" && hasValue) {
+            options.outputDir = argv[++i];
+        } else if (arg == "--raw-encoding" && hasValue) {
+            string encoding = argv[++i];
+            if (encoding == "s16") options.raw.encoding = AudioFile::RawFormat::Int16;
+            else if (encoding == "s24") options.raw.encoding = AudioFile::RawFormat::Int24;
+            else if (encoding == "s32") options.raw.encoding = AudioFile::RawFormat::Int32;
+            else if (encoding == "f32") options.raw.encoding = AudioFile::RawFormat::Float32;
+            else return usage(argv[0]);
+        } else if (arg == "--raw-channels" && hasValue) {
+            options.raw.channels = atoi(argv[++i]);
+        } else if (arg == "--raw-rate" && hasValue) {
+            options.raw.sampleRate = atof(argv[++i]);
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            return usage(argv[0]);
+        } else if (manifest.empty()) {
+            manifest = arg;
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    if (manifest.empty()) return usage(argv[0]);
+
+    vector<Job> jobs;
+    if (!readManifest(manifest, options, jobs)) return 1;
+    if (!options.outputDir.empty()) {
+        std::error_code ec;
+        std::filesystem::create_directories(options.outputDir, ec);
+    }
+
+    std::map<string, int> jobsPerScore;
+    for (const auto& job : jobs) jobsPerScore[job.scoreName]++;
+    ModelCache models(jobsPerScore);
+    FeatureExtractor extractor;
+
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<int> failed(0);
+    // Jobs share the process's pool with any parallel work within
+    // them, so that the two together use no more threads than it has
+    ThreadPool::setSharedThreadCount(options.threads);
+    ThreadPool& pool = ThreadPool::getShared();
+    for (const auto& job : jobs) {
+        pool.submit([&, job]() {
+            if (!runJob(job, options, extractor, models)) failed++;
+        });
+    }
+    pool.wait();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Aligned " << (jobs.size() - failed) << " of " << jobs.size()
+              << " recording(s) in " << seconds << "s" << std::endl;
+    return failed > 0 ? 1 : 0;
+}
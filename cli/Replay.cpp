@@ -0,0 +1,169 @@
+/*
+  Replay an alignment captured by the plugin (see FeatureCapture),
+  feeding the captured spectra straight into an aligner set up as the
+  plugin's was, and timing it. For profiling, and for comparing the
+  onsets before and after a change to the aligner.
+
+  Usage: score-aligner-replay [options] CAPTURE
+
+  Options:
+    --score NAME    align against NAME instead of the captured score
+    --repeat N      align N times, each on a fresh aligner, and report
+                    the fastest and mean times (default 1)
+    --serial        align in one pass, even if the plugin split the
+                    alignment into segments aligned in parallel
+    --parallel      split into segments aligned in parallel, even if the
+                    plugin did not
+    --dense         calculate likelihoods as full dot products, see
+                    AudioToScoreAligner::setDenseLikelihoods
+    --persist       keep likelihoods on disk and reuse those kept before,
+                    as the plugin does, see LikelihoodCache
+    --stats         print the alignment statistics of the last run
+    --save FILE     write the onsets found to FILE
+    --compare FILE  compare the onsets found with those saved in FILE,
+                    and fail if any differ
+
+  Scores are found on the score path as for the plugin, see Paths.
+*/
+
+#include "AudioToScoreAligner.h"
+#include "FeatureCapture.h"
+#include "Log.h"
+#include "ScoreModel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+static int usage(const char* name)
+{
+    std::cerr << "Usage: " << name << " [--score NAME] [--repeat N] [--serial|--parallel]\n"
+              << "       [--dense] [--persist] [--stats] [--save FILE] [--compare FILE] CAPTURE" << std::endl;
+    return 2;
+}
+
+int main(int argc, char** argv)
+{
+    string capturePath, scoreName, saveFile, compareFile;
+    int repeat = 1;
+    int parallel = -1; // as captured
+    bool dense = false, persist = false, stats = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = (i + 1 < argc);
+        if (arg == "--score" && hasValue) {
+            scoreName = argv[++i];
+        } else if (arg == "--repeat" && hasValue) {
+            repeat = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--serial") {
+            parallel = 0;
+        } else if (arg == "--parallel") {
+            parallel = 1;
+        } else if (arg == "--dense") {
+            dense = true;
+        } else if (arg == "--persist") {
+            persist = true;
+        } else if (arg == "--stats") {
+            stats = true;
+        } else if (arg == "--save" && hasValue) {
+            saveFile = argv[++i];
+        } else if (arg == "--compare" && hasValue) {
+            compareFile = argv[++i];
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            return usage(argv[0]);
+        } else if (capturePath.empty()) {
+            capturePath = arg;
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    if (capturePath.empty()) return usage(argv[0]);
+
+    FeatureCapture capture;
+    if (!FeatureCapture::read(capturePath, capture)) return 1;
+    if (scoreName.empty()) scoreName = capture.scoreName;
+    if (parallel < 0) parallel = capture.segmentParallel;
+
+    std::cout << "capture: score " << capture.scoreName << ", " << capture.features.size()
+              << " frames at " << capture.sampleRate << " Hz, events " << capture.startEvent
+              << " to " << capture.endEvent << "\nparameters:";
+    for (const auto& parameter : capture.parameters) {
+        std::cout << ' ' << parameter.first << '=' << parameter.second;
+    }
+    std::cout << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    auto model = std::make_shared<ScoreModel>(capture.sampleRate, capture.hopSize,
+                                              capture.blockSize);
+    if (!model->load(scoreName)) {
+        std::cerr << "Failed to load score " << scoreName << std::endl;
+        return 1;
+    }
+    std::cout << "load: " << std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count() << "s" << std::endl;
+
+    AudioToScoreAligner::AlignmentResults results;
+    double fastest = 0., total = 0.;
+    for (int run = 0; run < repeat; run++) {
+        AudioToScoreAligner aligner(model);
+        capture.configure(aligner);
+        aligner.setDenseLikelihoods(dense);
+        aligner.setPersistentLikelihoods(persist);
+        for (const auto& spectrum : capture.features) {
+            aligner.supplyFeature(spectrum);
+        }
+        start = std::chrono::steady_clock::now();
+        results = parallel ? aligner.alignInParallel() : aligner.align();
+        double seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+        std::cout << "align " << (run + 1) << ": " << seconds << "s" << std::endl;
+        fastest = (run == 0 ? seconds : std::min(fastest, seconds));
+        total += seconds;
+        if (stats && run + 1 == repeat) {
+            for (const auto& value : aligner.getStatistics()) {
+                std::cout << "  " << value.first << ": " << value.second << '\n';
+            }
+        }
+    }
+    if (repeat > 1) {
+        std::cout << "fastest " << fastest << "s, mean " << total / repeat << "s" << std::endl;
+    }
+
+    if (!saveFile.empty()) {
+        std::ofstream out(saveFile);
+        for (int onset : results) out << onset << '\n';
+        if (!out) {
+            std::cerr << "Failed to write " << saveFile << std::endl;
+            return 1;
+        }
+    }
+
+    if (!compareFile.empty()) {
+        std::ifstream in(compareFile);
+        if (!in) {
+            std::cerr << "Failed to read " << compareFile << std::endl;
+            return 1;
+        }
+        vector<int> saved;
+        int onset;
+        while (in >> onset) saved.push_back(onset);
+        int differing = 0;
+        for (size_t i = 0; i < std::max(saved.size(), results.size()); i++) {
+            if (i >= saved.size() || i >= results.size() || saved[i] != results[i]) {
+                differing++;
+            }
+        }
+        std::cout << differing << " of " << results.size() << " onset(s) differ from "
+                  << compareFile << std::endl;
+        if (differing > 0) return 1;
+    }
+    return 0;
+}